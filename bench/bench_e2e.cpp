@@ -0,0 +1,431 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+// End-to-end latency and throughput of the in-process server against
+// loopback clients. Each scenario reports messages/s and the latency
+// distribution from the producing call until the consumer received it:
+//
+//   push        audio thread per handler, pushMessage, one client each
+//   push_call   time spent inside pushMessage on the audio thread
+//   broadcast   as push, every handler fanned out to all clients
+//   client_read clients send, a consumer per handler pops
+//
+// Usage: bench_e2e [--handlers N] [--clients M] [--messages K]
+//                  [--interval-us U] [--park] [--json]
+// With --park idle dispatch workers park right away, so pushes pay for
+// waking them. With --json every scenario prints one JSON object per line.
+
+#include <clap-rpc/client/client.hpp>
+#include <clap-rpc/server.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace clap::rpc;
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options
+{
+    size_t handlers = 4;
+    size_t clients = 4;
+    size_t messages = 20'000; // per handler and producer
+    std::chrono::microseconds interval = 100us;
+    bool park = false;
+    bool json = false;
+};
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch())
+        .count();
+}
+
+// Latency samples in nanoseconds, merged from all consumer threads.
+class Samples
+{
+public:
+    void merge(std::vector<int64_t> &&samples)
+    {
+        std::scoped_lock lock(mMtx);
+        mSamples.insert(mSamples.end(), samples.begin(), samples.end());
+    }
+
+    size_t size() const
+    {
+        return mSamples.size();
+    }
+
+    void sort()
+    {
+        std::ranges::sort(mSamples);
+    }
+
+    double percentileUs(double p) const
+    {
+        if (mSamples.empty())
+            return 0.0;
+        const auto index = static_cast<size_t>(p * static_cast<double>(mSamples.size() - 1));
+        return static_cast<double>(mSamples[index]) / 1e3;
+    }
+
+    // Counts per power of two microseconds, bucket i holds [2^(i-1), 2^i).
+    std::vector<size_t> histogram() const
+    {
+        std::vector<size_t> buckets;
+        for (const int64_t sample : mSamples) {
+            const auto us = static_cast<uint64_t>(std::max<int64_t>(sample / 1000, 0));
+            const auto bucket = static_cast<size_t>(std::bit_width(us));
+            if (bucket >= buckets.size())
+                buckets.resize(bucket + 1);
+            ++buckets[bucket];
+        }
+        return buckets;
+    }
+
+private:
+    std::mutex mMtx;
+    std::vector<int64_t> mSamples;
+};
+
+struct Result
+{
+    std::string_view scenario;
+    size_t sent = 0;
+    size_t received = 0;
+    double seconds = 0.0;
+};
+
+void report(const Options &options, const Result &result, Samples &samples)
+{
+    samples.sort();
+    const double rate = result.seconds > 0 ? static_cast<double>(result.received) / result.seconds
+                                           : 0.0;
+    if (options.json) {
+        std::string histogram;
+        for (const size_t count : samples.histogram())
+            histogram += std::format("{}{}", histogram.empty() ? "" : ",", count);
+        std::cout << std::format(
+            "{{\"scenario\":\"{}\",\"handlers\":{},\"clients\":{},\"interval_us\":{},"
+            "\"sent\":{},\"received\":{},\"seconds\":{:.3f},\"msgs_per_s\":{:.0f},"
+            "\"p50_us\":{:.1f},\"p99_us\":{:.1f},\"p999_us\":{:.1f},\"max_us\":{:.1f},"
+            "\"histogram_log2_us\":[{}]}}\n",
+            result.scenario, options.handlers, options.clients, options.interval.count(),
+            result.sent, result.received, result.seconds, rate, samples.percentileUs(0.5),
+            samples.percentileUs(0.99), samples.percentileUs(0.999), samples.percentileUs(1.0),
+            histogram);
+        return;
+    }
+    std::cout << std::format("{:<12} {:>10} {:>10} {:>12.0f} {:>10.1f} {:>10.1f} {:>10.1f} "
+                             "{:>10.1f}\n",
+        result.scenario, result.sent, result.received, rate, samples.percentileUs(0.5),
+        samples.percentileUs(0.99), samples.percentileUs(0.999), samples.percentileUs(1.0));
+}
+
+template <typename Predicate>
+bool waitFor(Predicate &&predicate, std::chrono::milliseconds timeout = 10s)
+{
+    const auto deadline = Clock::now() + timeout;
+    while (!predicate()) {
+        if (Clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+// Seconds from start until the last receive, both from nowNs.
+double elapsedSeconds(int64_t start, int64_t last)
+{
+    return last > start ? static_cast<double>(last - start) / 1e9 : 0.0;
+}
+
+class Bench
+{
+public:
+    explicit Bench(const Options &options)
+        : mOptions(options)
+    {
+        Server::configure({ .addressUri = "localhost:0",
+            .dispatchWorkers = std::max<size_t>(1, std::thread::hardware_concurrency() / 4),
+            .workerWait = options.park ? WaitStrategy{ .spinCount = 0, .yieldCount = 0 }
+                                       : WaitStrategy{},
+            .streamLimits = { .maxQueuedMessages = 1 << 16 } });
+        mServer = Server::uniqueInstance();
+        for (size_t i = 0; i < options.handlers; ++i)
+            mHandlers.emplace_back(mServer->createStreamHandler());
+        for (size_t i = 0; i < options.clients; ++i)
+            mClients.emplace_back(std::make_unique<Client>(ClientConfig{ .uri = mServer->uri() }));
+    }
+
+    [[nodiscard]] bool isReady() const
+    {
+        return mServer->isRunning();
+    }
+
+    // Connects client c to the handlers selected by wants(c, h).
+    template <typename Wants>
+    bool connect(Wants &&wants)
+    {
+        for (size_t c = 0; c < mClients.size(); ++c) {
+            for (size_t h = 0; h < mHandlers.size(); ++h) {
+                if (wants(c, h))
+                    mClients[c]->connect(mHandlers[h]->id());
+            }
+        }
+        return waitFor([&] {
+            for (size_t c = 0; c < mClients.size(); ++c) {
+                for (size_t h = 0; h < mHandlers.size(); ++h) {
+                    if (wants(c, h) && !mClients[c]->isConnected(mHandlers[h]->id()))
+                        return false;
+                }
+            }
+            return true;
+        });
+    }
+
+    void disconnectAll()
+    {
+        for (const auto &client : mClients) {
+            for (const auto &handler : mHandlers)
+                client->disconnect(handler->id());
+        }
+        waitFor([&] {
+            return std::ranges::all_of(mHandlers,
+                [](const auto &handler) { return handler->numStreams() == 0; });
+        });
+    }
+
+    // Every handler pushes options.messages timestamped messages from its
+    // own "audio thread", the clients record the delivery latency. calls
+    // receives how long each pushMessage took. Every push reaches fanout
+    // clients, the clock stops at the last receive.
+    Result runServerToClient(std::string_view scenario, size_t fanout, Samples &samples,
+        Samples &calls)
+    {
+        std::atomic<size_t> received = 0;
+        std::atomic<int64_t> lastReceived = 0;
+        std::vector<std::jthread> consumers;
+        for (const auto &client : mClients) {
+            consumers.emplace_back([&, c = client.get()](std::stop_token stoken) {
+                std::vector<int64_t> local;
+                local.reserve(mOptions.messages * mHandlers.size() * fanout / mClients.size() + 1);
+                std::vector<ReceivedMessage> batch(64);
+                while (!stoken.stop_requested()) {
+                    const size_t count = c->tryPop(batch);
+                    const int64_t now = nowNs();
+                    for (size_t i = 0; i < count; ++i)
+                        local.push_back(now - batch[i].message.event().batch().steady_time());
+                    if (count == 0) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    lastReceived.store(now, std::memory_order_relaxed);
+                    received.fetch_add(count, std::memory_order_relaxed);
+                }
+                samples.merge(std::move(local));
+            });
+        }
+
+        const int64_t start = nowNs();
+        std::atomic<size_t> pushed = 0;
+        std::vector<std::jthread> producers;
+        for (const auto &handler : mHandlers) {
+            producers.emplace_back([&, h = handler.get()] {
+                std::vector<int64_t> local;
+                local.reserve(mOptions.messages);
+                auto next = Clock::now();
+                for (size_t i = 0; i < mOptions.messages; ++i) {
+                    auto message = h->acquireMessage();
+                    if (!message)
+                        continue;
+                    auto *batch = message->mutable_event()->mutable_batch();
+                    batch->set_frames_count(static_cast<uint32_t>(i));
+                    batch->set_steady_time(nowNs());
+                    const int64_t begin = nowNs();
+                    h->pushMessage(std::move(message));
+                    local.push_back(nowNs() - begin);
+                    pushed.fetch_add(1, std::memory_order_relaxed);
+                    if (mOptions.interval.count() > 0) {
+                        next += mOptions.interval;
+                        while (Clock::now() < next)
+                            std::this_thread::yield();
+                    }
+                }
+                calls.merge(std::move(local));
+            });
+        }
+        producers.clear();
+        const size_t sent = pushed.load() * fanout;
+        waitFor([&] { return received.load() >= sent; }, 2s);
+        consumers.clear();
+        return { scenario, sent, received.load(), elapsedSeconds(start, lastReceived.load()) };
+    }
+
+    // Every client sends options.messages timestamped messages to each
+    // handler, a consumer per handler blocks in popFor.
+    Result runClientToPlugin(Samples &samples)
+    {
+        const size_t expected = mOptions.messages * mClients.size();
+        std::atomic<size_t> received = 0;
+        std::atomic<int64_t> lastReceived = 0;
+        std::vector<std::jthread> consumers;
+        for (const auto &handler : mHandlers) {
+            consumers.emplace_back([&, h = handler.get()](std::stop_token stoken) {
+                std::vector<int64_t> local;
+                local.reserve(expected);
+                api::ClientMessage message;
+                while (!stoken.stop_requested()) {
+                    if (!h->popFor(&message, 10ms))
+                        continue;
+                    int64_t sentAt = 0;
+                    const auto &value = message.custom().value();
+                    if (value.size() == sizeof(sentAt))
+                        std::memcpy(&sentAt, value.data(), sizeof(sentAt));
+                    const int64_t now = nowNs();
+                    local.push_back(now - sentAt);
+                    lastReceived.store(now, std::memory_order_relaxed);
+                    received.fetch_add(1, std::memory_order_relaxed);
+                }
+                samples.merge(std::move(local));
+            });
+        }
+
+        const int64_t start = nowNs();
+        size_t sent = 0;
+        {
+            std::vector<std::jthread> producers;
+            std::atomic<size_t> accepted = 0;
+            for (const auto &client : mClients) {
+                producers.emplace_back([&, c = client.get()] {
+                    api::ClientMessage message;
+                    auto next = Clock::now();
+                    for (size_t i = 0; i < mOptions.messages; ++i) {
+                        for (const auto &handler : mHandlers) {
+                            const int64_t now = nowNs();
+                            message.mutable_custom()->set_value(
+                                reinterpret_cast<const char *>(&now), sizeof(now));
+                            if (c->send(handler->id(), message))
+                                accepted.fetch_add(1, std::memory_order_relaxed);
+                        }
+                        if (mOptions.interval.count() > 0) {
+                            next += mOptions.interval;
+                            while (Clock::now() < next)
+                                std::this_thread::yield();
+                        }
+                    }
+                });
+            }
+            producers.clear();
+            sent = accepted.load();
+        }
+        waitFor([&] { return received.load() >= sent; }, 2s);
+        consumers.clear();
+        return { "client_read", sent, received.load(), elapsedSeconds(start, lastReceived.load()) };
+    }
+
+    [[nodiscard]] size_t numHandlers() const
+    {
+        return mHandlers.size();
+    }
+    [[nodiscard]] size_t numClients() const
+    {
+        return mClients.size();
+    }
+
+private:
+    const Options &mOptions;
+    std::shared_ptr<Server> mServer;
+    std::vector<std::shared_ptr<StreamHandler>> mHandlers;
+    std::vector<std::unique_ptr<Client>> mClients;
+};
+
+Options parse(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const auto value = [&] { return i + 1 < argc ? std::strtoull(argv[++i], nullptr, 10) : 0; };
+        if (arg == "--handlers")
+            options.handlers = std::max<size_t>(1, value());
+        else if (arg == "--clients")
+            options.clients = std::max<size_t>(1, value());
+        else if (arg == "--messages")
+            options.messages = value();
+        else if (arg == "--interval-us")
+            options.interval = std::chrono::microseconds(value());
+        else if (arg == "--park")
+            options.park = true;
+        else if (arg == "--json")
+            options.json = true;
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const Options options = parse(argc, argv);
+    Bench bench(options);
+    if (!bench.isReady()) {
+        std::cerr << "server failed to start\n";
+        return EXIT_FAILURE;
+    }
+    if (!options.json) {
+        std::cout << std::format("{} handlers, {} clients, {} messages, {} us interval\n",
+            options.handlers, options.clients, options.messages, options.interval.count());
+        std::cout << std::format("{:<12} {:>10} {:>10} {:>12} {:>10} {:>10} {:>10} {:>10}\n",
+            "scenario", "sent", "received", "msgs/s", "p50 us", "p99 us", "p999 us", "max us");
+    }
+
+    // One client per handler.
+    const size_t clients = bench.numClients();
+    if (!bench.connect([&](size_t c, size_t h) { return h % clients == c; })) {
+        std::cerr << "clients failed to connect\n";
+        return EXIT_FAILURE;
+    }
+    {
+        Samples samples;
+        Samples calls;
+        report(options,
+            bench.runServerToClient("push", 1, samples, calls),
+            samples);
+        report(options, { "push_call", calls.size(), calls.size(), 0.0 }, calls);
+    }
+    {
+        Samples samples;
+        report(options, bench.runClientToPlugin(samples), samples);
+    }
+    bench.disconnectAll();
+
+    // Every client on every handler.
+    if (!bench.connect([](size_t, size_t) { return true; })) {
+        std::cerr << "clients failed to connect\n";
+        return EXIT_FAILURE;
+    }
+    {
+        Samples samples;
+        Samples calls;
+        report(options,
+            bench.runServerToClient("broadcast", bench.numClients(), samples, calls),
+            samples);
+    }
+    bench.disconnectAll();
+    return EXIT_SUCCESS;
+}
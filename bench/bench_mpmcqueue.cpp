@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+// Contention harness for MpMcQueue. Runs 1P1C, NP1C and NPMC at different
+// starting fill levels and the drop-oldest overflow path, for a small POD and
+// api::ServerMessage payload. Threads are pinned to distinct cores where
+// possible. Reports ns/op and, where perf counters are available, cycles and
+// cache misses per operation summed over all threads.
+//
+// Usage: bench_mpmcqueue [--ops N] [--json]
+
+#include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <latch>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+  #include <linux/perf_event.h>
+  #include <pthread.h>
+  #include <sched.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+using namespace clap::rpc;
+
+namespace {
+
+constexpr size_t QueueSize = 256;
+
+struct Counters
+{
+    uint64_t cycles = 0;
+    uint64_t cacheMisses = 0;
+    bool isValid = false;
+
+    Counters &operator+=(const Counters &other)
+    {
+        cycles += other.cycles;
+        cacheMisses += other.cacheMisses;
+        isValid = isValid && other.isValid;
+        return *this;
+    }
+};
+
+// Hardware counters of the calling thread. Unavailable without
+// perf_event_open permission, e.g. in containers.
+class PerfCounters
+{
+public:
+    PerfCounters()
+    {
+#if defined(__linux__)
+        mCycles = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (mCycles >= 0)
+            mCacheMisses = open(PERF_COUNT_HW_CACHE_MISSES, mCycles);
+#endif
+    }
+    ~PerfCounters()
+    {
+#if defined(__linux__)
+        if (mCacheMisses >= 0)
+            close(mCacheMisses);
+        if (mCycles >= 0)
+            close(mCycles);
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    void start()
+    {
+#if defined(__linux__)
+        if (mCycles >= 0) {
+            ioctl(mCycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(mCycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    Counters stop()
+    {
+        Counters counters;
+#if defined(__linux__)
+        if (mCycles < 0 || mCacheMisses < 0)
+            return counters;
+        ioctl(mCycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        counters.isValid = read(mCycles, &counters.cycles, sizeof(uint64_t)) == sizeof(uint64_t)
+            && read(mCacheMisses, &counters.cacheMisses, sizeof(uint64_t)) == sizeof(uint64_t);
+#endif
+        return counters;
+    }
+
+private:
+#if defined(__linux__)
+    static int open(uint64_t config, int group)
+    {
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = group < 0 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+    }
+#endif
+    int mCycles = -1;
+    int mCacheMisses = -1;
+};
+
+// Backs off to the scheduler after a while, so oversubscribed runs with
+// more threads than cores still make progress.
+void backoff(uint32_t &spins)
+{
+    if (++spins % 64 == 0)
+        std::this_thread::yield();
+}
+
+void pinToCore(size_t index)
+{
+#if defined(__linux__)
+    const auto cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) index;
+#endif
+}
+
+struct Result
+{
+    double nsPerOp = 0.0;
+    uint64_t ops = 0;
+    // Pushes that failed even after discarding the oldest element.
+    uint64_t failedPushes = 0;
+    Counters counters = { .isValid = true };
+};
+
+template <typename T>
+T makePayload()
+{
+    if constexpr (std::is_same_v<T, api::ServerMessage>) {
+        T message;
+        auto *note = message.mutable_event()->mutable_event()->mutable_note();
+        note->set_key(60);
+        note->set_velocity(0.5);
+        return message;
+    } else {
+        return T{};
+    }
+}
+
+// Starts with fill elements queued, then producers push perProducer
+// elements each while consumers pop the same total. Threads spin when the
+// queue is full or empty.
+template <typename T, QueueLayout Layout>
+Result runContention(size_t producers, size_t consumers, size_t perProducer, size_t fill)
+{
+    auto queue = std::make_unique<MpMcQueue<T, QueueSize, Layout>>();
+    const T payload = makePayload<T>();
+    for (size_t i = 0; i < fill; ++i)
+        queue->tryPush(T(payload));
+
+    const size_t total = producers * perProducer;
+    std::atomic<size_t> popped = 0;
+    std::latch ready(static_cast<std::ptrdiff_t>(producers + consumers + 1));
+    std::vector<Counters> counters(producers + consumers);
+    std::chrono::steady_clock::time_point start;
+    {
+        std::vector<std::jthread> threads;
+        for (size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                pinToCore(p);
+                PerfCounters perf;
+                ready.arrive_and_wait();
+                perf.start();
+                uint32_t spins = 0;
+                for (size_t i = 0; i < perProducer; ++i) {
+                    while (!queue->tryPush(T(payload)))
+                        backoff(spins);
+                }
+                counters[p] = perf.stop();
+            });
+        }
+        for (size_t c = 0; c < consumers; ++c) {
+            threads.emplace_back([&, c] {
+                pinToCore(producers + c);
+                PerfCounters perf;
+                T out{};
+                uint32_t spins = 0;
+                ready.arrive_and_wait();
+                perf.start();
+                while (popped.load(std::memory_order_relaxed) < total) {
+                    if (queue->pop(&out))
+                        popped.fetch_add(1, std::memory_order_relaxed);
+                    else
+                        backoff(spins);
+                }
+                counters[producers + c] = perf.stop();
+            });
+        }
+        start = std::chrono::steady_clock::now();
+        ready.arrive_and_wait();
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now()
+        - start;
+
+    Result result;
+    result.ops = total * 2; // every element is pushed and popped
+    result.nsPerOp = elapsed.count() / static_cast<double>(result.ops);
+    for (const auto &c : counters)
+        result.counters += c;
+    return result;
+}
+
+// Producers push into a full queue without a consumer, so every push takes
+// the drop-oldest path and discards an element.
+template <typename T, QueueLayout Layout>
+Result runOverflow(size_t producers, size_t perProducer)
+{
+    auto queue = std::make_unique<MpMcQueue<T, QueueSize, Layout>>();
+    const T payload = makePayload<T>();
+    while (queue->tryPush(T(payload)))
+        ;
+
+    std::atomic<uint64_t> failed = 0;
+    std::latch ready(static_cast<std::ptrdiff_t>(producers + 1));
+    std::vector<Counters> counters(producers);
+    std::chrono::steady_clock::time_point start;
+    {
+        std::vector<std::jthread> threads;
+        for (size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                pinToCore(p);
+                PerfCounters perf;
+                ready.arrive_and_wait();
+                perf.start();
+                uint64_t lost = 0;
+                for (size_t i = 0; i < perProducer; ++i)
+                    lost += queue->push(T(payload)) ? 0 : 1;
+                counters[p] = perf.stop();
+                failed.fetch_add(lost, std::memory_order_relaxed);
+            });
+        }
+        start = std::chrono::steady_clock::now();
+        ready.arrive_and_wait();
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now()
+        - start;
+
+    Result result;
+    result.ops = producers * perProducer;
+    result.nsPerOp = elapsed.count() / static_cast<double>(result.ops);
+    result.failedPushes = failed.load();
+    for (const auto &c : counters)
+        result.counters += c;
+    return result;
+}
+
+struct Row
+{
+    std::string_view payload;
+    std::string_view layout;
+    std::string scenario;
+    size_t fill = 0;
+    Result result;
+};
+
+void print(const Row &row, bool json)
+{
+    const auto &r = row.result;
+    const double ops = static_cast<double>(r.ops);
+    if (json) {
+        std::cout << std::format(
+            "{{\"payload\":\"{}\",\"layout\":\"{}\",\"scenario\":\"{}\",\"fill\":{},"
+            "\"ops\":{},\"ns_per_op\":{:.2f},\"failed_pushes\":{},\"cycles_per_op\":{},"
+            "\"cache_misses_per_op\":{}}}\n",
+            row.payload, row.layout, row.scenario, row.fill, r.ops, r.nsPerOp, r.failedPushes,
+            r.counters.isValid ? std::format("{:.2f}", static_cast<double>(r.counters.cycles) / ops)
+                               : "null",
+            r.counters.isValid
+                ? std::format("{:.4f}", static_cast<double>(r.counters.cacheMisses) / ops)
+                : "null");
+        return;
+    }
+    std::cout << std::format("{:<20} {:<12} {:<10} {:>6} {:>10.2f} {:>12} {:>14}\n", row.payload,
+        row.layout, row.scenario, row.fill, r.nsPerOp,
+        r.counters.isValid ? std::format("{:.2f}", static_cast<double>(r.counters.cycles) / ops)
+                           : "n/a",
+        r.counters.isValid
+            ? std::format("{:.4f}", static_cast<double>(r.counters.cacheMisses) / ops)
+            : "n/a");
+}
+
+template <typename T, QueueLayout Layout>
+void runAll(std::string_view payload, std::string_view layout, size_t ops, bool json)
+{
+    struct Shape
+    {
+        std::string_view name;
+        size_t producers;
+        size_t consumers;
+    };
+    const size_t n = std::max(2u, std::thread::hardware_concurrency() / 2);
+    const Shape shapes[] = { { "1P1C", 1, 1 }, { "NP1C", n, 1 }, { "NPMC", n, n } };
+    for (const auto &shape : shapes) {
+        for (const size_t fill : { size_t(0), QueueSize / 2, QueueSize - 8 }) {
+            const auto result = runContention<T, Layout>(shape.producers, shape.consumers,
+                ops / shape.producers, fill);
+            const auto name = shape.name == "1P1C"
+                ? std::string(shape.name)
+                : std::format("{}{}", shape.name, shape.producers);
+            print({ payload, layout, name, fill, result }, json);
+        }
+    }
+    print({ payload, layout, "overflow", QueueSize, runOverflow<T, Layout>(1, ops) }, json);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t ops = 1'000'000;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--ops" && i + 1 < argc)
+            ops = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        else if (arg == "--json")
+            json = true;
+    }
+
+    if (!json) {
+        std::cout << std::format("{:<20} {:<12} {:<10} {:>6} {:>10} {:>12} {:>14}\n", "payload",
+            "layout", "scenario", "fill", "ns/op", "cycles/op", "misses/op");
+    }
+    runAll<uint64_t, QueueLayout::Compact>("uint64_t", "compact", ops, json);
+    runAll<uint64_t, QueueLayout::Interleaved>("uint64_t", "interleaved", ops, json);
+    runAll<api::ServerMessage, QueueLayout::Compact>("api::ServerMessage", "compact", ops / 4,
+        json);
+    runAll<api::ServerMessage, QueueLayout::Interleaved>("api::ServerMessage", "interleaved",
+        ops / 4, json);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+// Compares the memory footprint per StreamHandler and the throughput under
+// contention of the MpMcQueue layouts.
+
+#include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/messagepool.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace clap::rpc;
+
+namespace {
+
+constexpr size_t QueueSize = 256;
+
+template <typename Queue>
+size_t footprint()
+{
+    // The compact storage is part of sizeof(Queue), the others live on the heap.
+    return sizeof(Queue) >= Queue::storageSize() ? sizeof(Queue)
+                                                 : sizeof(Queue) + Queue::storageSize();
+}
+
+void printFootprint()
+{
+    using CompactClient = MpMcQueue<api::ClientMessage, QueueSize>;
+    using CompactServer = MpMcQueue<api::ServerMessage, QueueSize>;
+    using InterleavedClient = MpMcQueue<api::ClientMessage, QueueSize, QueueLayout::Interleaved>;
+    using InterleavedServer = MpMcQueue<api::ServerMessage, QueueSize, QueueLayout::Interleaved>;
+    using ServerPool = MessagePool<api::ServerMessage, QueueSize>;
+    using ClientPool = MessagePool<api::ClientMessage, QueueSize>;
+
+    const auto row = [](std::string_view name, size_t inlineBytes, size_t total) {
+        std::cout << std::format("{:<28} {:>12} {:>12}\n", name, inlineBytes, total);
+    };
+    std::cout << "memory per handler (client + server queue), bytes\n";
+    std::cout << std::format("{:<28} {:>12} {:>12}\n", "layout", "inline", "total");
+    row("compact", sizeof(CompactClient) + sizeof(CompactServer),
+        footprint<CompactClient>() + footprint<CompactServer>());
+    row("interleaved", sizeof(InterleavedClient) + sizeof(InterleavedServer),
+        footprint<InterleavedClient>() + footprint<InterleavedServer>());
+    row("index-slot",
+        sizeof(ClientPool::HandleQueue) * 2 + sizeof(ClientPool) + sizeof(ServerPool),
+        footprint<ClientPool::HandleQueue>() * 2 + sizeof(ClientPool) + sizeof(ServerPool)
+            + ClientPool::storageSize() + ServerPool::storageSize());
+    std::cout << '\n';
+}
+
+template <typename Push, typename Pop>
+double run(int producers, size_t perProducer, Push &&push, Pop &&pop)
+{
+    const auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&] {
+                for (size_t i = 0; i < perProducer; ++i) {
+                    while (!push(i))
+                        std::this_thread::yield();
+                }
+            });
+        }
+        threads.emplace_back([&] {
+            const size_t total = perProducer * static_cast<size_t>(producers);
+            for (size_t received = 0; received != total;) {
+                if (pop())
+                    ++received;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(perProducer) * producers / elapsed.count() / 1e6;
+}
+
+template <typename T, QueueLayout Layout>
+double runQueue(int producers, size_t perProducer)
+{
+    auto queue = std::make_unique<MpMcQueue<T, QueueSize, Layout>>();
+    T payload{};
+    T out{};
+    return run(
+        producers, perProducer, [&](size_t) { return queue->tryPush(T(payload)); },
+        [&] { return queue->pop(&out); });
+}
+
+template <typename T>
+double runIndexSlot(int producers, size_t perProducer)
+{
+    using Pool = MessagePool<T, QueueSize>;
+    auto pool = std::make_unique<Pool>();
+    auto ring = std::make_unique<typename Pool::HandleQueue>();
+    return run(
+        producers, perProducer,
+        [&](size_t) {
+            const auto handle = pool->acquire();
+            if (handle == Pool::InvalidHandle)
+                return false;
+            (*pool)[handle] = T{};
+            return ring->tryPush(handle);
+        },
+        [&] {
+            typename Pool::Handle handle = Pool::InvalidHandle;
+            if (!ring->pop(&handle))
+                return false;
+            pool->release(handle);
+            return true;
+        });
+}
+
+template <typename T>
+void printContention(std::string_view payload, size_t perProducer)
+{
+    std::cout << std::format("throughput NP1C, payload {}, Mmsg/s\n", payload);
+    std::cout << std::format("{:<12} {:>12} {:>12} {:>12}\n", "producers", "compact",
+        "interleaved", "index-slot");
+    for (int producers : { 1, 2, 4 }) {
+        std::cout << std::format("{:<12} {:>12.2f} {:>12.2f} {:>12.2f}\n", producers,
+            runQueue<T, QueueLayout::Compact>(producers, perProducer),
+            runQueue<T, QueueLayout::Interleaved>(producers, perProducer),
+            runIndexSlot<T>(producers, perProducer));
+    }
+    std::cout << '\n';
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const size_t perProducer = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+    printFootprint();
+    printContention<uint64_t>("uint64_t", perProducer);
+    printContention<api::ServerMessage>("api::ServerMessage", perProducer / 4);
+    return 0;
+}
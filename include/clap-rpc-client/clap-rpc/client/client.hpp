@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/global.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+struct ClientConfig
+{
+    // Server URI, e.g. localhost:port or unix:path.
+    std::string uri;
+    // A dropped stream is reopened right away, further attempts back off
+    // exponentially up to maxReconnectDelay.
+    std::chrono::milliseconds reconnectDelay = std::chrono::milliseconds(10);
+    std::chrono::milliseconds maxReconnectDelay = std::chrono::seconds(1);
+    int maxReceiveMessageSize = -1;
+};
+
+struct ReceivedMessage
+{
+    uint64_t pluginId = 0;
+    api::ServerMessage message;
+};
+
+class ClientPrivate;
+
+// Reactor based EventStream client. All plugin streams share one channel,
+// and so one HTTP/2 connection. Messages are read on gRPC threads into a
+// lock-free queue and handed out by tryPop or poll on the consumer thread.
+class Client
+{
+public:
+    using Callback = std::function<void(uint64_t pluginId, const api::ServerMessage &)>;
+
+    explicit Client(ClientConfig config);
+    ~Client();
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    Client(Client &&) = delete;
+    Client &operator=(Client &&) = delete;
+
+    // Opens the EventStream of the plugin, which is reopened whenever it
+    // ends until disconnect is called. Returns false if already connected.
+    bool connect(uint64_t pluginId);
+    void disconnect(uint64_t pluginId);
+    // Whether the server accepted the stream and it is still open.
+    [[nodiscard]] bool isConnected(uint64_t pluginId) const;
+
+    // Queues the message for the stream of the plugin. Messages sent while
+    // the stream reconnects are dropped, returns false then.
+    bool send(uint64_t pluginId, const api::ClientMessage &message);
+
+    bool tryPop(ReceivedMessage *message);
+    // Moves up to messages.size() received messages out, returns the count.
+    size_t tryPop(std::span<ReceivedMessage> messages);
+
+    // Callbacks per ServerMessage oneof case, invoked by poll. Register
+    // them before polling.
+    void on(api::ServerMessage::DataCase type, Callback &&callback);
+    // Dispatches up to maxMessages received messages on the calling thread,
+    // returns the count. Messages without callback are discarded.
+    size_t poll(size_t maxMessages = 256);
+
+    // Messages discarded because the receive queue was full.
+    [[nodiscard]] uint64_t droppedMessages() const noexcept;
+    // Streams opened again after they ended.
+    [[nodiscard]] uint64_t reconnects() const noexcept;
+
+private:
+    std::unique_ptr<ClientPrivate> dPtr;
+};
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/global.hpp>
+
+#include <clap/clap.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Fixed-layout records for the NativeEvents lane. Every record starts with a
+// Header mirroring clap_event_header and is followed by its payload, padding
+// is explicit so the layout doesn't depend on the compiler. Pointers such as
+// the parameter cookie are not transferred. Encoding and decoding is a
+// bounds-checked memcpy, clients that understand the layout skip protobuf
+// parsing of the individual events entirely.
+namespace native {
+
+inline constexpr uint32_t FormatVersion = 1;
+
+static_assert(std::endian::native == std::endian::little,
+    "native event records are little-endian on the wire");
+
+struct Header
+{
+    uint32_t size;
+    uint32_t time;
+    uint16_t spaceId;
+    uint16_t type;
+    uint32_t flags;
+};
+
+struct NoteRecord
+{
+    Header header;
+    int32_t noteId;
+    int16_t portIndex;
+    int16_t channel;
+    int16_t key;
+    int16_t reserved0;
+    uint32_t reserved1;
+    double velocity;
+};
+
+struct NoteExpressionRecord
+{
+    Header header;
+    int32_t expressionId;
+    int32_t noteId;
+    int16_t portIndex;
+    int16_t channel;
+    int16_t key;
+    int16_t reserved;
+    double value;
+};
+
+// CLAP_EVENT_PARAM_VALUE and CLAP_EVENT_PARAM_MOD, value holds the amount of
+// a modulation.
+struct ParamRecord
+{
+    Header header;
+    uint32_t paramId;
+    int32_t noteId;
+    int16_t portIndex;
+    int16_t channel;
+    int16_t key;
+    int16_t reserved;
+    double value;
+};
+
+struct ParamGestureRecord
+{
+    Header header;
+    uint32_t paramId;
+    uint32_t reserved;
+};
+
+struct MidiRecord
+{
+    Header header;
+    uint16_t portIndex;
+    uint8_t data[3];
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(Header) == 16);
+static_assert(sizeof(NoteRecord) == 40 && offsetof(NoteRecord, velocity) == 32);
+static_assert(sizeof(NoteExpressionRecord) == 40 && offsetof(NoteExpressionRecord, value) == 32);
+static_assert(sizeof(ParamRecord) == 40 && offsetof(ParamRecord, value) == 32);
+static_assert(sizeof(ParamGestureRecord) == 24);
+static_assert(sizeof(MidiRecord) == 24);
+
+template <typename T>
+concept Record = std::is_trivially_copyable_v<T> && std::is_standard_layout_v<T>
+    && std::is_same_v<decltype(T::header), Header>;
+
+// Appends records to a NativeEvents message, usually one per process() call.
+class EventWriter
+{
+public:
+    explicit EventWriter(api::event::NativeEvents *events, size_t reserveRecords = 0)
+        : mRecords(events->mutable_records())
+    {
+        events->set_version(FormatVersion);
+        mRecords->reserve(reserveRecords * sizeof(NoteRecord));
+    }
+
+    template <Record T>
+    void append(T record)
+    {
+        record.header.size = sizeof(T);
+        mRecords->append(reinterpret_cast<const char *>(&record), sizeof(T));
+    }
+
+    // Converts a core CLAP event. Returns false for event types the lane
+    // doesn't carry, which should be sent as EventMessage instead.
+    bool append(const clap_event_header_t *event);
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return mRecords->size();
+    }
+
+private:
+    static Header header(const clap_event_header_t *event)
+    {
+        return { 0, event->time, event->space_id, event->type, event->flags };
+    }
+
+    std::string *mRecords;
+};
+
+// Walks the records of a NativeEvents message. Malformed or truncated input
+// ends the iteration, it never reads past the payload.
+class EventReader
+{
+public:
+    explicit EventReader(const api::event::NativeEvents &events)
+        : mRecords(events.version() == FormatVersion ? std::string_view(events.records())
+                                                      : std::string_view())
+    {
+    }
+
+    // Advances to the next record and copies its header.
+    bool next(Header *header)
+    {
+        mOffset += mCurrent;
+        mCurrent = 0;
+        if (mRecords.size() - mOffset < sizeof(Header))
+            return false;
+        std::memcpy(header, mRecords.data() + mOffset, sizeof(Header));
+        if (header->size < sizeof(Header) || header->size > mRecords.size() - mOffset) {
+            mOffset = mRecords.size();
+            return false;
+        }
+        mCurrent = header->size;
+        return true;
+    }
+
+    // Copies the current record. Fails if it is smaller than T, larger
+    // records of newer minor revisions are truncated.
+    template <Record T>
+    bool read(T *record) const
+    {
+        if (mCurrent < sizeof(T))
+            return false;
+        std::memcpy(record, mRecords.data() + mOffset, sizeof(T));
+        return true;
+    }
+
+private:
+    std::string_view mRecords;
+    size_t mOffset = 0;
+    size_t mCurrent = 0;
+};
+
+inline bool EventWriter::append(const clap_event_header_t *event)
+{
+    if (!event || event->space_id != CLAP_CORE_EVENT_SPACE_ID)
+        return false;
+
+    switch (event->type) {
+    case CLAP_EVENT_NOTE_ON:
+    case CLAP_EVENT_NOTE_OFF:
+    case CLAP_EVENT_NOTE_CHOKE:
+    case CLAP_EVENT_NOTE_END: {
+        const auto *note = reinterpret_cast<const clap_event_note_t *>(event);
+        append(NoteRecord{ header(event), note->note_id, note->port_index, note->channel,
+            note->key, 0, 0, note->velocity });
+        return true;
+    }
+    case CLAP_EVENT_NOTE_EXPRESSION: {
+        const auto *expr = reinterpret_cast<const clap_event_note_expression_t *>(event);
+        append(NoteExpressionRecord{ header(event), expr->expression_id, expr->note_id,
+            expr->port_index, expr->channel, expr->key, 0, expr->value });
+        return true;
+    }
+    case CLAP_EVENT_PARAM_VALUE: {
+        const auto *param = reinterpret_cast<const clap_event_param_value_t *>(event);
+        append(ParamRecord{ header(event), param->param_id, param->note_id, param->port_index,
+            param->channel, param->key, 0, param->value });
+        return true;
+    }
+    case CLAP_EVENT_PARAM_MOD: {
+        const auto *param = reinterpret_cast<const clap_event_param_mod_t *>(event);
+        append(ParamRecord{ header(event), param->param_id, param->note_id, param->port_index,
+            param->channel, param->key, 0, param->amount });
+        return true;
+    }
+    case CLAP_EVENT_PARAM_GESTURE_BEGIN:
+    case CLAP_EVENT_PARAM_GESTURE_END: {
+        const auto *gesture = reinterpret_cast<const clap_event_param_gesture_t *>(event);
+        append(ParamGestureRecord{ header(event), gesture->param_id, 0 });
+        return true;
+    }
+    case CLAP_EVENT_MIDI: {
+        const auto *midi = reinterpret_cast<const clap_event_midi_t *>(event);
+        append(MidiRecord{ header(event), midi->port_index,
+            { midi->data[0], midi->data[1], midi->data[2] }, {} });
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+} // namespace native
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Identifies messages that supersede each other, e.g. values of the same
+// parameter. Of all pending messages with the same key only the most recent
+// one is delivered.
+struct CoalescingKey
+{
+    enum class Kind : uint32_t {
+        None = 0,
+        Parameter,
+        ParameterModulation,
+        Transport,
+        GuiSize,
+        User = 0x100, // first kind available for custom messages
+    };
+
+    static constexpr CoalescingKey parameter(uint32_t paramId) noexcept
+    {
+        return { Kind::Parameter, paramId };
+    }
+    static constexpr CoalescingKey parameterModulation(uint32_t paramId) noexcept
+    {
+        return { Kind::ParameterModulation, paramId };
+    }
+    static constexpr CoalescingKey transport() noexcept
+    {
+        return { Kind::Transport, 0 };
+    }
+    static constexpr CoalescingKey guiSize() noexcept
+    {
+        return { Kind::GuiSize, 0 };
+    }
+
+    static constexpr CoalescingKey fromValue(uint64_t value) noexcept
+    {
+        return { Kind(value >> 32), uint32_t(value) };
+    }
+
+    // Kind::None never coalesces, the id doesn't matter.
+    [[nodiscard]] constexpr bool isNull() const noexcept
+    {
+        return kind == Kind::None;
+    }
+    [[nodiscard]] constexpr uint64_t value() const noexcept
+    {
+        return (uint64_t(kind) << 32) | id;
+    }
+
+    friend constexpr bool operator==(const CoalescingKey &, const CoalescingKey &) = default;
+
+    Kind kind = Kind::None;
+    uint32_t id = 0;
+};
+
+// Lock-free open addressing table mapping coalescing keys to the handle of
+// their pending message. Keys are inserted on first use and never removed,
+// once the table is full further keys are not coalesced.
+template <size_t Size>
+requires(Size >= 2 && (Size & (Size - 1)) == 0)
+class CoalescingTable
+{
+public:
+    using Handle = uint32_t;
+    static constexpr Handle InvalidHandle = ~Handle(0);
+    static constexpr uint32_t InvalidEntry = ~uint32_t(0);
+
+    CoalescingTable() = default;
+
+    CoalescingTable(const CoalescingTable &) = delete;
+    CoalescingTable &operator=(const CoalescingTable &) = delete;
+
+    // Returns the entry of key, inserting it if needed. InvalidEntry if the
+    // key is null, whatever its id, or the table is full.
+    uint32_t entry(CoalescingKey key) noexcept
+    {
+        if (key.isNull())
+            return InvalidEntry;
+        const uint64_t value = key.value();
+        size_t index = hash(value);
+        for (size_t probe = 0; probe < Size; ++probe, index = (index + 1) & (Size - 1)) {
+            auto &slot = mEntries[index];
+            uint64_t current = slot.key.load(std::memory_order_acquire);
+            if (current == EmptyKey
+                && slot.key.compare_exchange_strong(current, value, std::memory_order_acq_rel))
+                return uint32_t(index);
+            if (current == value)
+                return uint32_t(index);
+        }
+        return InvalidEntry;
+    }
+
+    // Stores handle as the pending message of the entry and returns the one
+    // it superseded, or InvalidHandle if the entry had nothing pending.
+    Handle exchange(uint32_t entry, Handle handle) noexcept
+    {
+        return mEntries[entry].pending.exchange(handle, std::memory_order_acq_rel);
+    }
+
+    [[nodiscard]] CoalescingKey key(uint32_t entry) const noexcept
+    {
+        return CoalescingKey::fromValue(mEntries[entry].key.load(std::memory_order_acquire));
+    }
+
+    [[nodiscard]] Handle peek(uint32_t entry) const noexcept
+    {
+        return mEntries[entry].pending.load(std::memory_order_acquire);
+    }
+
+    // Takes the pending message out of the entry.
+    Handle take(uint32_t entry) noexcept
+    {
+        return exchange(entry, InvalidHandle);
+    }
+
+    static constexpr size_t capacity() noexcept
+    {
+        return Size;
+    }
+
+private:
+    static constexpr uint64_t EmptyKey = 0;
+
+    static constexpr size_t hash(uint64_t value) noexcept
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= value >> 33;
+        return size_t(value) & (Size - 1);
+    }
+
+    struct Entry
+    {
+        std::atomic<uint64_t> key = EmptyKey;
+        std::atomic<Handle> pending = InvalidHandle;
+    };
+    std::array<Entry, Size> mEntries = {};
+};
+
+CLAP_RPC_END_NAMESPACE
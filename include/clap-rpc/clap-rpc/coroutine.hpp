@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Decides where a suspended coroutine continues. Operations complete on gRPC
+// callback threads and hand the coroutine to the executor it was awaited with.
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+    virtual void post(std::coroutine_handle<> handle) = 0;
+};
+
+// Resumes right away on the thread that completed the operation, usually a
+// gRPC callback thread. Keep the code until the next co_await short.
+class InlineExecutor final : public Executor
+{
+public:
+    void post(std::coroutine_handle<> handle) override
+    {
+        handle.resume();
+    }
+
+    static InlineExecutor &instance() noexcept
+    {
+        static InlineExecutor executor;
+        return executor;
+    }
+};
+
+// Collects coroutines until runPending() is called, e.g. from the plugin main
+// thread. onPost runs on every post and may be used to request that call,
+// such as clap_host::request_callback.
+class QueuedExecutor final : public Executor
+{
+public:
+    explicit QueuedExecutor(std::function<void()> onPost = {})
+        : mOnPost(std::move(onPost))
+    {
+    }
+
+    void post(std::coroutine_handle<> handle) override
+    {
+        {
+            std::scoped_lock lock(mMtx);
+            mPending.push_back(handle);
+        }
+        if (mOnPost)
+            mOnPost();
+    }
+
+    // Resumes everything posted so far, returns the count.
+    size_t runPending()
+    {
+        {
+            std::scoped_lock lock(mMtx);
+            mRunning.swap(mPending);
+        }
+        const size_t count = mRunning.size();
+        for (const auto handle : mRunning)
+            handle.resume();
+        mRunning.clear();
+        return count;
+    }
+
+private:
+    std::function<void()> mOnPost;
+    std::mutex mMtx;
+    std::vector<std::coroutine_handle<>> mPending;
+    std::vector<std::coroutine_handle<>> mRunning;
+};
+
+// Minimal coroutine type that starts eagerly and is never awaited itself.
+struct FireAndForget
+{
+    struct promise_type
+    {
+        FireAndForget get_return_object() noexcept
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() noexcept { }
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+// Shared by all streams a message is sent to. Released by the last stream
+// once it was written or dropped, which resumes the sending coroutine.
+class WriteCompletion
+{
+public:
+    WriteCompletion(std::coroutine_handle<> handle, Executor *executor, size_t *written)
+        : mHandle(handle), mExecutor(executor), mResult(written)
+    {
+    }
+    ~WriteCompletion()
+    {
+        *mResult = mWritten.load(std::memory_order_acquire);
+        if (mHandle)
+            mExecutor->post(mHandle);
+    }
+
+    WriteCompletion(const WriteCompletion &) = delete;
+    WriteCompletion &operator=(const WriteCompletion &) = delete;
+
+    // The coroutine didn't suspend after all, only the result is stored.
+    void dismiss() noexcept
+    {
+        mHandle = {};
+    }
+
+    void markWritten() noexcept
+    {
+        mWritten.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    std::coroutine_handle<> mHandle;
+    Executor *mExecutor;
+    size_t *mResult;
+    std::atomic<size_t> mWritten = 0;
+};
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// A fixed set of preallocated objects addressed by small integer handles.
+// Rings can carry the handles instead of whole messages (index-slot mode),
+// which keeps the cells small and avoids moving payloads through the queue.
+// Acquiring and releasing is lock-free. Size bounds the handles, fewer slots
+// can be allocated at runtime.
+template <typename T, size_t Size>
+class MessagePool
+{
+public:
+    using Handle = uint32_t;
+    static constexpr Handle InvalidHandle = ~Handle(0);
+    using HandleQueue = MpMcQueue<Handle, Size, QueueLayout::Interleaved>;
+
+    explicit MessagePool(QueueMemory memory = QueueMemory::Default)
+        : MessagePool(Size, memory)
+    {
+    }
+    explicit MessagePool(size_t slots, QueueMemory memory = QueueMemory::Default)
+        : mSize(std::clamp<size_t>(slots, 1, Size))
+        , mSlots(std::make_unique<T[]>(mSize))
+        , mFree(memory)
+        , mRetired(memory)
+    {
+        for (Handle h = 0; h != mSize; ++h)
+            mFree.tryPush(h);
+    }
+
+    MessagePool(const MessagePool &) = delete;
+    MessagePool &operator=(const MessagePool &) = delete;
+
+    // Returns InvalidHandle if all slots are in use.
+    [[nodiscard]] Handle acquire() noexcept
+    {
+        Handle handle = InvalidHandle;
+        mFree.pop(&handle);
+        return handle;
+    }
+
+    void release(Handle handle) noexcept
+    {
+        mFree.tryPush(handle);
+    }
+
+    // Holds an acquired slot back as reserve. Not thread-safe, call before
+    // the pool is shared.
+    void keepReserve(Handle handle) noexcept
+    {
+        mKeepsReserve = true;
+        mReserve.store(handle, std::memory_order_relaxed);
+    }
+
+    // Takes the reserve slot, InvalidHandle if it is in use. Meant for a
+    // producer that had to retire a slot instead of reusing it, reclaim()
+    // puts the next recycled slot back into reserve.
+    [[nodiscard]] Handle acquireReserve() noexcept
+    {
+        if (mReserve.load(std::memory_order_relaxed) == InvalidHandle)
+            return InvalidHandle;
+        return mReserve.exchange(InvalidHandle, std::memory_order_acquire);
+    }
+
+    // Gives a slot back without making it available yet. Whoever consumes
+    // the pool cleans it up in reclaim(), so a producer never has to run the
+    // slot's cleanup, e.g. free memory, itself.
+    void retire(Handle handle) noexcept
+    {
+        mRetired.tryPush(handle);
+    }
+
+    // Calls recycle on every retired slot and releases it. Returns the count.
+    template <typename F>
+    size_t reclaim(F &&recycle)
+    {
+        Handle handle = InvalidHandle;
+        size_t count = 0;
+        for (; mRetired.pop(&handle); ++count) {
+            recycle(mSlots[handle]);
+            auto empty = InvalidHandle;
+            if (!mKeepsReserve
+                || !mReserve.compare_exchange_strong(empty, handle, std::memory_order_release,
+                    std::memory_order_relaxed))
+                mFree.tryPush(handle);
+        }
+        return count;
+    }
+
+    T &operator[](Handle handle) noexcept
+    {
+        return mSlots[handle];
+    }
+    const T &operator[](Handle handle) const noexcept
+    {
+        return mSlots[handle];
+    }
+
+    [[nodiscard]] size_t available() const noexcept
+    {
+        return mFree.size();
+    }
+
+    [[nodiscard]] size_t retired() const noexcept
+    {
+        return mRetired.size();
+    }
+
+    // Number of allocated slots.
+    [[nodiscard]] size_t size() const noexcept
+    {
+        return mSize;
+    }
+
+    static constexpr size_t capacity() noexcept
+    {
+        return Size;
+    }
+
+    // Bytes used for the slots and the handle queues with all Size slots.
+    static constexpr size_t storageSize() noexcept
+    {
+        return sizeof(T) * Size + HandleQueue::storageSize() * 2;
+    }
+
+private:
+    size_t mSize;
+    std::unique_ptr<T[]> mSlots;
+    HandleQueue mFree;
+    HandleQueue mRetired;
+    std::atomic<Handle> mReserve = InvalidHandle;
+    bool mKeepsReserve = false;
+};
+
+CLAP_RPC_END_NAMESPACE
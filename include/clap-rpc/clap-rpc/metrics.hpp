@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Metrics are recorded with relaxed atomics only. Recording is a single
+// uncontended read-modify-write, cheap enough for the audio thread. Readers
+// take snapshots that are consistent per value, not across values.
+class Counter
+{
+public:
+    void add(uint64_t n = 1) noexcept
+    {
+        mValue.fetch_add(n, std::memory_order_relaxed);
+    }
+    [[nodiscard]] uint64_t value() const noexcept
+    {
+        return mValue.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> mValue = 0;
+};
+
+struct HistogramSnapshot
+{
+    // Bucket i counts durations below 2^i ns and at least 2^(i-1) ns, the
+    // last bucket everything above.
+    static constexpr size_t BucketCount = 32;
+
+    std::array<uint64_t, BucketCount> buckets = {};
+    uint64_t count = 0;
+    std::chrono::nanoseconds sum = {};
+    std::chrono::nanoseconds max = {};
+
+    // Upper bound of the bucket holding the quantile q in [0, 1].
+    [[nodiscard]] std::chrono::nanoseconds percentile(double q) const noexcept
+    {
+        if (count == 0)
+            return {};
+        const auto rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; ++i) {
+            seen += buckets[i];
+            if (seen >= rank)
+                return std::min(max, std::chrono::nanoseconds(int64_t(1) << i));
+        }
+        return max;
+    }
+};
+
+// Latency distribution in power of two buckets.
+class LatencyHistogram
+{
+public:
+    void record(std::chrono::nanoseconds duration) noexcept
+    {
+        const auto ns = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+        const auto bucket = std::min<size_t>(std::bit_width(ns), mBuckets.size() - 1);
+        mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = mMax.load(std::memory_order_relaxed);
+        while (ns > max && !mMax.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    [[nodiscard]] HistogramSnapshot snapshot() const noexcept
+    {
+        HistogramSnapshot snapshot;
+        for (size_t i = 0; i < HistogramSnapshot::BucketCount; ++i) {
+            snapshot.buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+            snapshot.count += snapshot.buckets[i];
+        }
+        snapshot.sum = std::chrono::nanoseconds(mSum.load(std::memory_order_relaxed));
+        snapshot.max = std::chrono::nanoseconds(mMax.load(std::memory_order_relaxed));
+        return snapshot;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, HistogramSnapshot::BucketCount> mBuckets = {};
+    std::atomic<uint64_t> mSum = 0;
+    std::atomic<uint64_t> mMax = 0;
+};
+
+struct StreamStats
+{
+    // Messages waiting behind the write in flight.
+    size_t queueDepth = 0;
+    // Dropped or replaced because the client didn't keep up.
+    uint64_t droppedMessages = 0;
+    uint64_t writtenMessages = 0;
+    // From handing the message to the stream until gRPC completed the write.
+    HistogramSnapshot writeLatency = {};
+};
+
+struct HandlerStats
+{
+    uint64_t id = 0;
+    size_t worker = 0;
+    // Messages queued for dispatch, and client messages not yet popped.
+    size_t pendingMessages = 0;
+    size_t pendingClientMessages = 0;
+    uint64_t pushedMessages = 0;
+    // Replaced in place by a message with the same coalescing key.
+    uint64_t coalescedMessages = 0;
+    // Sacrificed because all pool slots were pending, or lost with none left.
+    uint64_t droppedMessages = 0;
+    uint64_t dispatchedMessages = 0;
+    uint64_t clientMessages = 0;
+    // Discarded because the client queue was full.
+    uint64_t droppedClientMessages = 0;
+    // Time to serialize a message once and hand it to all streams.
+    HistogramSnapshot broadcastTime = {};
+    std::vector<StreamStats> streams;
+};
+
+struct WorkerStats
+{
+    uint64_t wakeups = 0;
+    // Times the idle worker got ready to park, and kernel wakes producers
+    // issued for it. Producers never wake a worker that isn't parking.
+    uint64_t parks = 0;
+    uint64_t kernelWakes = 0;
+    uint64_t dispatchedHandlers = 0;
+    uint64_t dispatchedMessages = 0;
+};
+
+struct ServerStats
+{
+    std::vector<WorkerStats> workers;
+    std::vector<HandlerStats> handlers;
+};
+
+CLAP_RPC_END_NAMESPACE
@@ -5,20 +5,116 @@
 
 #include <clap-rpc/global.hpp>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#if defined(__linux__)
+  #include <sys/mman.h>
+#endif
 
 CLAP_RPC_BEGIN_NAMESPACE
 
-template <typename T, size_t Size>
+inline constexpr size_t CacheLineSize = 64;
+
+enum class QueueLayout {
+    // Cells are stored inline and packed, neighbouring cells share cache lines.
+    Compact,
+    // Sequences and payloads live in separate heap arrays. Consecutive
+    // positions are spread across cache lines, so producers and consumers
+    // working on neighbouring cells don't contend, without padding overhead.
+    Interleaved,
+};
+
+enum class QueueMemory { Default, HugePages };
+
+namespace detail {
+
+// Cache line aligned heap memory, optionally backed by huge pages.
+class AlignedMemory
+{
+public:
+    AlignedMemory() = default;
+    AlignedMemory(size_t bytes, QueueMemory memory)
+        : mBytes(bytes)
+    {
+#if defined(__linux__)
+        if (memory == QueueMemory::HugePages) {
+            constexpr size_t HugePageSize = size_t(2) << 20;
+            const size_t mapped = (bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+            void *ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (ptr != MAP_FAILED) {
+                mData = ptr;
+                mBytes = mapped;
+                mIsMapped = true;
+                return;
+            }
+        }
+#endif
+        (void) memory; // fall back to regular pages
+        mData = ::operator new(bytes, std::align_val_t(CacheLineSize));
+    }
+    ~AlignedMemory()
+    {
+        if (!mData)
+            return;
+#if defined(__linux__)
+        if (mIsMapped) {
+            munmap(mData, mBytes);
+            return;
+        }
+#endif
+        ::operator delete(mData, std::align_val_t(CacheLineSize));
+    }
+
+    AlignedMemory(const AlignedMemory &) = delete;
+    AlignedMemory &operator=(const AlignedMemory &) = delete;
+
+    [[nodiscard]] void *data() const noexcept
+    {
+        return mData;
+    }
+    [[nodiscard]] bool isHugePage() const noexcept
+    {
+        return mIsMapped;
+    }
+
+private:
+    void *mData = nullptr;
+    size_t mBytes = 0;
+    bool mIsMapped = false;
+};
+
+// Maps an index so that consecutive indices land on different cache lines.
+template <size_t ElementSize, size_t Size>
+constexpr size_t interleave(size_t index) noexcept
+{
+    constexpr size_t PerLine = std::min(
+        std::bit_floor(std::max<size_t>(CacheLineSize / ElementSize, 1)), Size);
+    constexpr size_t Lines = Size / PerLine;
+    return (index % Lines) * PerLine + index / Lines;
+}
+
+} // namespace detail
+
+template <typename T, size_t Size, QueueLayout Layout = QueueLayout::Compact>
 requires(Size >= 2 && (Size & (Size - 1)) == 0)
 class MpMcQueue
 {
 public:
-    MpMcQueue()
+    explicit MpMcQueue(QueueMemory memory = QueueMemory::Default)
+        : mStorage(memory)
     {
         for (size_t i = 0; i != Size; i += 1)
-            mBuffer[i].sequence.store(i, std::memory_order_relaxed);
+            sequenceAt(i).store(i, std::memory_order_relaxed);
         mHead.store(0, std::memory_order_relaxed);
         mTail.store(0, std::memory_order_relaxed);
     }
@@ -30,12 +126,13 @@ public:
     MpMcQueue(MpMcQueue &&) = default;
     MpMcQueue &operator=(MpMcQueue &&) = default;
 
+    // Pushes the element, dropping the oldest one if the queue is full.
     bool push(auto &&data)
     {
         if (!tryPush(std::forward<decltype(data)>(data))) {
-            T temp;
-            if (!pop(&temp))
+            if (!discard())
                 return false;
+            mDiscarded.fetch_add(1, std::memory_order_relaxed);
             if (!tryPush(std::forward<decltype(data)>(data)))
                 return false;
         }
@@ -44,46 +141,97 @@ public:
 
     bool tryPush(auto &&data)
     {
-        size_t pos = mHead.load(std::memory_order_relaxed);
-        while (true) {
-            Cell *cell = &mBuffer[pos & mBufferMask];
-            size_t seq = cell->sequence.load(std::memory_order_acquire);
-            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
-            if (dif == 0) { // Try to advance the enqueue pos
-                if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
-                    break;
-            } else if (dif < 0) { // Queue is full
+        return tryEmplace(std::forward<decltype(data)>(data));
+    }
+
+    // Constructs the element in place, dropping the oldest one if the queue
+    // is full.
+    template <typename... Args>
+    bool emplace(Args &&...args)
+    {
+        if (!tryEmplace(std::forward<Args>(args)...)) {
+            if (!discard())
+                return false;
+            mDiscarded.fetch_add(1, std::memory_order_relaxed);
+            if (!tryEmplace(std::forward<Args>(args)...))
                 return false;
-            } else {
-                pos = mHead.load(std::memory_order_relaxed);
-            }
         }
-        Cell *cell = &mBuffer[pos & mBufferMask];
-        cell->data = std::forward<decltype(data)>(data);
-        cell->sequence.store(pos + 1, std::memory_order_release);
         return true;
     }
 
-    bool pop(T *data)
+    template <typename... Args>
+    bool tryEmplace(Args &&...args)
     {
-        size_t pos = mTail.load(std::memory_order_relaxed);
-        while (true) {
-            Cell *cell = &mBuffer[pos & mBufferMask];
-            size_t seq = cell->sequence.load(std::memory_order_acquire);
-            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
-            if (dif == 0) { // Try to advance the dequeue pos
-                if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
-                    break;
-            } else if (dif < 0) { // Queue is empty
-                return false;
-            } else { // Retry from current position
-                pos = mTail.load(std::memory_order_relaxed);
-            }
+        const auto [pos, count] = claim(mHead, 0, 1);
+        if (count == 0)
+            return false;
+        construct(dataAt(pos), std::forward<Args>(args)...);
+        sequenceAt(pos).store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves up to count elements from first into the queue, claiming all of
+    // them with a single CAS. Returns the number of elements pushed.
+    template <std::forward_iterator It>
+    size_t tryPushN(It first, size_t count)
+    {
+        const auto [pos, claimed] = claim(mHead, 0, count);
+        for (size_t i = 0; i != claimed; ++i, ++first) {
+            dataAt(pos + i) = std::move(*first);
+            sequenceAt(pos + i).store(pos + i + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    // Like tryPushN, but drops the oldest elements to make room.
+    template <std::forward_iterator It>
+    size_t pushN(It first, size_t count)
+    {
+        size_t pushed = tryPushN(first, count);
+        while (pushed != count) {
+            if (!discard())
+                break;
+            mDiscarded.fetch_add(1, std::memory_order_relaxed);
+            const size_t n = tryPushN(std::next(first, static_cast<ptrdiff_t>(pushed)),
+                count - pushed);
+            if (n == 0)
+                break;
+            pushed += n;
         }
-        Cell *cell = &mBuffer[pos & mBufferMask];
-        *data = cell->data;
+        return pushed;
+    }
+
+    bool pop(T *data)
+    {
+        const auto [pos, count] = claim(mTail, 1, 1);
+        if (count == 0)
+            return false;
+        *data = std::move(dataAt(pos));
         // Increase sequence by buffer size for wrap-around
-        cell->sequence.store(pos + Size, std::memory_order_release);
+        sequenceAt(pos).store(pos + Size, std::memory_order_release);
+        return true;
+    }
+
+    // Moves up to count elements into out, claiming all of them with a
+    // single CAS. Returns the number of elements popped.
+    template <std::output_iterator<T> It>
+    size_t popN(It out, size_t count)
+    {
+        const auto [pos, claimed] = claim(mTail, 1, count);
+        for (size_t i = 0; i != claimed; ++i, ++out) {
+            *out = std::move(dataAt(pos + i));
+            sequenceAt(pos + i).store(pos + i + Size, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    // Drops the oldest element without handing it out.
+    bool discard()
+    {
+        const auto [pos, count] = claim(mTail, 1, 1);
+        if (count == 0)
+            return false;
+        sequenceAt(pos).store(pos + Size, std::memory_order_release);
         return true;
     }
 
@@ -97,16 +245,153 @@ public:
         return size() <= 0;
     }
 
+    // Elements dropped by push, emplace and pushN to make room.
+    [[nodiscard]] uint64_t discarded() const noexcept
+    {
+        return mDiscarded.load(std::memory_order_relaxed);
+    }
+
+    static constexpr size_t capacity() noexcept
+    {
+        return Size;
+    }
+
+    // Bytes used for sequences and payloads, inline or on the heap.
+    static constexpr size_t storageSize() noexcept
+    {
+        return Storage::Bytes;
+    }
+
 private:
     struct Cell
     {
         std::atomic<size_t> sequence;
         T data;
     };
-    std::array<Cell, Size> mBuffer = {};
+
+    struct CompactStorage
+    {
+        static constexpr size_t Bytes = sizeof(std::array<Cell, Size>);
+
+        explicit CompactStorage(QueueMemory) { }
+
+        std::atomic<size_t> &sequence(size_t index) noexcept
+        {
+            return cells[index].sequence;
+        }
+        T &data(size_t index) noexcept
+        {
+            return cells[index].data;
+        }
+
+        std::array<Cell, Size> cells = {};
+    };
+
+    struct InterleavedStorage
+    {
+        using Sequence = std::atomic<size_t>;
+        static_assert(alignof(T) <= CacheLineSize);
+        static constexpr size_t SequenceBytes = (sizeof(Sequence) * Size + CacheLineSize - 1)
+            & ~(CacheLineSize - 1);
+        static constexpr size_t Bytes = SequenceBytes + sizeof(T) * Size;
+
+        explicit InterleavedStorage(QueueMemory kind)
+            : memory(Bytes, kind)
+            , sequences(static_cast<Sequence *>(this->memory.data()))
+            , payloads(reinterpret_cast<T *>(static_cast<std::byte *>(this->memory.data())
+                  + SequenceBytes))
+        {
+            std::uninitialized_default_construct_n(sequences, Size);
+            std::uninitialized_value_construct_n(payloads, Size);
+        }
+        ~InterleavedStorage()
+        {
+            std::destroy_n(payloads, Size);
+            std::destroy_n(sequences, Size);
+        }
+
+        InterleavedStorage(const InterleavedStorage &) = delete;
+        InterleavedStorage &operator=(const InterleavedStorage &) = delete;
+
+        Sequence &sequence(size_t index) noexcept
+        {
+            return sequences[detail::interleave<sizeof(Sequence), Size>(index)];
+        }
+        T &data(size_t index) noexcept
+        {
+            return payloads[detail::interleave<sizeof(T), Size>(index)];
+        }
+
+        detail::AlignedMemory memory;
+        Sequence *sequences;
+        T *payloads;
+    };
+
+    using Storage = std::conditional_t<Layout == QueueLayout::Compact, CompactStorage,
+        InterleavedStorage>;
+
+    std::atomic<size_t> &sequenceAt(size_t pos) noexcept
+    {
+        return mStorage.sequence(pos & mBufferMask);
+    }
+    T &dataAt(size_t pos) noexcept
+    {
+        return mStorage.data(pos & mBufferMask);
+    }
+
+    struct Claim
+    {
+        size_t pos;
+        size_t count;
+    };
+
+    // Claims up to count consecutive cells starting at the current position
+    // of cursor. A cell is available once its sequence equals pos + offset,
+    // which is 0 for producers and 1 for consumers.
+    Claim claim(std::atomic<size_t> &cursor, size_t offset, size_t count)
+    {
+        count = std::min(count, Size);
+        size_t pos = cursor.load(std::memory_order_relaxed);
+        while (true) {
+            size_t available = 0;
+            intptr_t dif = 0;
+            for (; available != count; ++available) {
+                const size_t seq = sequenceAt(pos + available).load(std::memory_order_acquire);
+                dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + available + offset);
+                if (dif != 0)
+                    break;
+            }
+            if (available != 0) { // Try to advance the position over the whole range
+                if (cursor.compare_exchange_weak(pos, pos + available, std::memory_order_relaxed))
+                    return { pos, available };
+            } else if (dif < 0) { // Queue is full (producer) or empty (consumer)
+                return { pos, 0 };
+            } else { // Retry from current position
+                pos = cursor.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template <typename... Args>
+    static void construct(T &data, Args &&...args)
+    {
+        if constexpr (sizeof...(Args) == 1
+            && (std::is_same_v<std::remove_cvref_t<Args>, T> && ...)) {
+            data = (std::forward<Args>(args), ...);
+        } else if constexpr (std::is_nothrow_constructible_v<T, Args...>) {
+            std::destroy_at(&data);
+            std::construct_at(&data, std::forward<Args>(args)...);
+        } else {
+            data = T(std::forward<Args>(args)...);
+        }
+    }
+
+    Storage mStorage;
     const size_t mBufferMask = Size - 1;
     alignas(64) std::atomic<size_t> mHead;
     alignas(64) std::atomic<size_t> mTail;
+    // Next to the tail, which discarding writes anyway.
+    std::atomic<uint64_t> mDiscarded = 0;
     static_assert(std::atomic<size_t>::is_always_lock_free);
 };
 
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Bounded ring between the threads broadcasting to a Stream and its gRPC
+// callback thread. Any thread may push, e.g. dispatch workers of several
+// handlers feeding one multiplexed stream or a user thread broadcasting
+// directly. Both ends claim cells with a CAS, which also lets a producer
+// evict the oldest element itself while the consumer is stuck behind a slow
+// write.
+template <typename T>
+class OutboundRing
+{
+public:
+    explicit OutboundRing(size_t capacity)
+        : mCapacity(std::bit_ceil(std::max<size_t>(capacity, 2)))
+        , mMask(mCapacity - 1)
+        , mCells(std::make_unique<Cell[]>(mCapacity))
+    {
+        for (size_t i = 0; i < mCapacity; ++i)
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    OutboundRing(const OutboundRing &) = delete;
+    OutboundRing &operator=(const OutboundRing &) = delete;
+
+    // Leaves value untouched if the ring is full.
+    bool tryPush(T &&value)
+    {
+        size_t pos = mHead.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = mCells[pos & mMask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false; // full
+            } else {
+                pos = mHead.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Safe to call from the consumer and the producers.
+    bool pop(T *value)
+    {
+        size_t pos = mTail.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = mCells[pos & mMask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    *value = std::move(cell.value);
+                    cell.sequence.store(pos + mCapacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false; // empty
+            } else {
+                pos = mTail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    [[nodiscard]] bool isEmpty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        const size_t tail = mTail.load(std::memory_order_acquire);
+        const size_t head = mHead.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept
+    {
+        return mCapacity;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t mCapacity;
+    const size_t mMask;
+    std::unique_ptr<Cell[]> mCells;
+    alignas(CacheLineSize) std::atomic<size_t> mHead = 0;
+    alignas(CacheLineSize) std::atomic<size_t> mTail = 0;
+};
+
+CLAP_RPC_END_NAMESPACE
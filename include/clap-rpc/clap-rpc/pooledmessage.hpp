@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/messagepool.hpp>
+
+#include <google/protobuf/arena.h>
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// A ServerMessage living in an arena with a preallocated initial block.
+// The initial block belongs to the thread that last reset the arena, any
+// other thread allocating gets a block of its own from the heap. rearm()
+// therefore resets the arena on the filling thread, building a message that
+// fits into the block doesn't touch the heap then. Strings beyond the small
+// string size still allocate, and are freed by whoever resets the arena.
+class ArenaMessage
+{
+public:
+    static constexpr size_t BlockSize = 512;
+
+    ArenaMessage()
+        : mArena(options(mBlock))
+    {
+    }
+
+    ArenaMessage(const ArenaMessage &) = delete;
+    ArenaMessage &operator=(const ArenaMessage &) = delete;
+
+    // Creates a fresh message and makes the calling thread the owner of the
+    // initial block. The reset frees nothing as long as the arena is
+    // compact, which recycle() ensures, so it is safe on the audio thread.
+    api::ServerMessage *rearm()
+    {
+        assert(mMessage == nullptr && "rearm() without recycle()");
+        assert(isCompact() && "rearm() would free on the calling thread");
+        mArena.Reset();
+        mMessage = google::protobuf::Arena::CreateMessage<api::ServerMessage>(&mArena);
+        return mMessage;
+    }
+
+    // Discards the message and frees the blocks the arena had to allocate
+    // beyond the initial one. Runs on the consumer side only, see
+    // MessagePool::retire().
+    void recycle()
+    {
+        mMessage = nullptr;
+        mArena.Reset();
+    }
+
+    // Discards the message of a compact arena without resetting it, the next
+    // rearm() does. Never frees, unlike recycle().
+    void discard() noexcept
+    {
+        assert(isCompact());
+        mMessage = nullptr;
+    }
+
+    // True if the arena holds nothing but the initial block.
+    [[nodiscard]] bool isCompact() const
+    {
+        return mArena.SpaceAllocated() <= BlockSize;
+    }
+
+    [[nodiscard]] api::ServerMessage *message() const noexcept
+    {
+        return mMessage;
+    }
+
+private:
+    static google::protobuf::ArenaOptions options(std::array<std::byte, BlockSize> &block)
+    {
+        google::protobuf::ArenaOptions opts;
+        opts.initial_block = reinterpret_cast<char *>(block.data());
+        opts.initial_block_size = block.size();
+        return opts;
+    }
+
+    alignas(CacheLineSize) std::array<std::byte, BlockSize> mBlock;
+    google::protobuf::Arena mArena;
+    api::ServerMessage *mMessage = nullptr;
+};
+
+using ServerMessagePool = MessagePool<ArenaMessage, 128>;
+
+// Move-only handle to a pooled ServerMessage. Obtained through
+// StreamHandler::acquireMessage() and published with pushMessage(). A handle
+// that is destroyed without being published retires its slot, the dispatch
+// worker recycles it.
+class PooledMessage
+{
+public:
+    PooledMessage() = default;
+    ~PooledMessage()
+    {
+        reset();
+    }
+
+    PooledMessage(const PooledMessage &) = delete;
+    PooledMessage &operator=(const PooledMessage &) = delete;
+
+    PooledMessage(PooledMessage &&other) noexcept
+        : mPool(std::exchange(other.mPool, nullptr))
+        , mHandle(std::exchange(other.mHandle, ServerMessagePool::InvalidHandle))
+        , mMessage(std::exchange(other.mMessage, nullptr))
+    {
+    }
+    PooledMessage &operator=(PooledMessage &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            mPool = std::exchange(other.mPool, nullptr);
+            mHandle = std::exchange(other.mHandle, ServerMessagePool::InvalidHandle);
+            mMessage = std::exchange(other.mMessage, nullptr);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] explicit operator bool() const noexcept
+    {
+        return mMessage != nullptr;
+    }
+
+    [[nodiscard]] api::ServerMessage *get() const noexcept
+    {
+        return mMessage;
+    }
+    api::ServerMessage *operator->() const noexcept
+    {
+        return mMessage;
+    }
+    api::ServerMessage &operator*() const noexcept
+    {
+        return *mMessage;
+    }
+
+    // Gives the slot back without publishing the message.
+    void reset() noexcept
+    {
+        if (mPool)
+            mPool->retire(mHandle);
+        mPool = nullptr;
+        mHandle = ServerMessagePool::InvalidHandle;
+        mMessage = nullptr;
+    }
+
+private:
+    PooledMessage(ServerMessagePool *pool, ServerMessagePool::Handle handle,
+        api::ServerMessage *message)
+        : mPool(pool), mHandle(handle), mMessage(message)
+    {
+    }
+
+    ServerMessagePool::Handle release() noexcept
+    {
+        mPool = nullptr;
+        mMessage = nullptr;
+        return std::exchange(mHandle, ServerMessagePool::InvalidHandle);
+    }
+
+    ServerMessagePool *mPool = nullptr;
+    ServerMessagePool::Handle mHandle = ServerMessagePool::InvalidHandle;
+    api::ServerMessage *mMessage = nullptr;
+
+    friend class StreamHandler;
+};
+
+CLAP_RPC_END_NAMESPACE
@@ -4,17 +4,102 @@
 #pragma once
 
 #include <clap-rpc/global.hpp>
+#include <clap-rpc/metrics.hpp>
 #include <clap-rpc/streamhandler.hpp>
+#include <clap-rpc/waitstrategy.hpp>
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 CLAP_RPC_BEGIN_NAMESPACE
 
+// What happens once a stream's outbound queue is full, i.e. the client
+// doesn't keep up with the messages broadcast to it.
+enum class SlowConsumerPolicy {
+    // Drop the oldest queued message, starting with the bulk lane.
+    DropOldest,
+    // A queued message is replaced in place by a newer one with the same
+    // coalescing key, once full the oldest message is dropped.
+    Coalesce,
+    // Cancel the stream, the client has to reconnect.
+    Cancel,
+};
+
+struct StreamLimits
+{
+    // Messages queued per stream in addition to the one being written.
+    size_t maxQueuedMessages = 1024;
+    SlowConsumerPolicy policy = SlowConsumerPolicy::DropOldest;
+};
+
+// Shared memory data plane for clients on the same machine, negotiated over
+// the EventStream. Realtime messages are published once into a ring per
+// StreamHandler instead of being written to every local stream.
+struct SharedMemoryConfig
+{
+    bool enabled = true;
+    // Bytes of the ring, rounded up to a power of two.
+    size_t ringSize = size_t(1) << 20;
+};
+
+// Detects dead clients without waiting for the TCP timeout. Zero keeps the
+// gRPC default.
+struct KeepaliveConfig
+{
+    // Ping interval and how long to wait for the ack before closing.
+    std::chrono::milliseconds time = {};
+    std::chrono::milliseconds timeout = {};
+    // Ping idle connections too, i.e. streams without pending messages.
+    bool permitWithoutCalls = false;
+    // Shortest ping interval accepted from clients.
+    std::chrono::milliseconds minClientPingInterval = {};
+};
+
+// Upper bounds for the gRPC threads and buffers of the whole server. Zero is
+// unlimited.
+struct ResourceLimits
+{
+    int maxThreads = 0;
+    size_t maxMemory = 0;
+};
+
+// HTTP/2 transport tuning. Zero keeps the gRPC default.
+struct Http2Config
+{
+    // Initial per-stream flow control window.
+    int streamWindowSize = 0;
+    // Grows the windows based on the measured bandwidth-delay product. Turn
+    // off for a fixed window.
+    bool bdpProbe = true;
+    int maxFrameSize = 0;
+    int writeBufferSize = 0;
+};
+
 struct ServerConfig
 {
+    // Either host:port, unix:path or unix-abstract:name.
     std::string addressUri = "localhost:0";
+    // Further listeners of the same service, e.g. a Unix domain socket for
+    // local clients next to the TCP port.
+    std::vector<std::string> extraListeners = {};
+    // Per message limits in bytes, -1 keeps the gRPC default.
+    int maxReceiveMessageSize = -1;
+    int maxSendMessageSize = -1;
+    KeepaliveConfig keepalive = {};
+    ResourceLimits resources = {};
+    Http2Config http2 = {};
+    // Number of dispatch workers. StreamHandlers are sharded across them.
+    size_t dispatchWorkers = 1;
+    WaitStrategy workerWait = {};
+    // Preallocated messages per StreamHandler, see acquireMessage(). Every
+    // slot takes about 600 bytes, at most ServerMessagePool::capacity().
+    size_t messagePoolSize = ServerMessagePool::capacity();
+    StreamLimits streamLimits = {};
+    SharedMemoryConfig sharedMemory = {};
 };
 
 class ServerPrivate;
@@ -39,16 +124,23 @@ public:
     static void configure(ServerConfig config);
 
     [[nodiscard]] bool isRunning() const noexcept;
+    // For Unix domain sockets the address is the whole URI and port is -1.
     [[nodiscard]] std::string_view address() const noexcept;
     [[nodiscard]] int port() const noexcept;
     [[nodiscard]] std::string uri() const;
 
+    // Empty once HandlerRegistry::capacity() handlers are alive. IDs of
+    // released handlers are never handed out again.
     [[nodiscard]] std::shared_ptr<StreamHandler> createStreamHandler();
 
+    // Snapshot of all workers and live handlers, also served by the GetStats
+    // RPC.
+    [[nodiscard]] ServerStats stats() const;
+
     bool stop();
 
 private:
-    bool tryNotify();
+    bool tryNotify(StreamHandler *handler);
 
 private:
     std::unique_ptr<ServerPrivate> dPtr;
@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#if defined(__linux__)
+  #include <poll.h>
+  #include <sys/mman.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Layout of the shared memory data plane. A single writer in the server
+// publishes serialized ServerMessages as length-prefixed records into a byte
+// ring, every local reader follows with its own cursor. The writer never
+// waits for readers: a reader that falls a whole ring behind loses messages
+// and is told so. Readers validate each record after copying it, since the
+// writer may have overwritten it meanwhile. Readers map the ring read-only,
+// only the sleeper count lives in a separate, writable mapping.
+namespace shm {
+
+inline constexpr uint32_t RingMagic = 0x43524d52; // "RMRC"
+inline constexpr uint32_t RingVersion = 2;
+inline constexpr uint32_t PaddingRecord = ~uint32_t(0);
+inline constexpr size_t RecordAlignment = 8;
+
+struct RingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity; // bytes of record data following the header, power of two
+    // End of the bytes the writer may be touching, moved before writing.
+    alignas(CacheLineSize) std::atomic<uint64_t> reserved;
+    // End of the published records.
+    alignas(CacheLineSize) std::atomic<uint64_t> head;
+};
+
+struct SleeperHeader
+{
+    // Readers parked on their doorbell, the writer only signals if non-zero.
+    alignas(CacheLineSize) std::atomic<uint32_t> count;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free
+    && std::atomic<uint32_t>::is_always_lock_free);
+
+inline constexpr size_t SleepersSize = sizeof(SleeperHeader);
+
+// Order of the descriptors passed to a reader.
+enum Descriptor : size_t { MemoryFd, SleepersFd, DoorbellFd, DescriptorCount };
+using Descriptors = std::array<int, DescriptorCount>;
+
+inline constexpr size_t DataOffset = (sizeof(RingHeader) + CacheLineSize - 1)
+    & ~(CacheLineSize - 1);
+
+struct RecordHeader
+{
+    uint32_t size;
+    uint32_t reserved;
+};
+
+constexpr size_t recordSize(size_t payload) noexcept
+{
+    return (sizeof(RecordHeader) + payload + RecordAlignment - 1) & ~(RecordAlignment - 1);
+}
+
+#if defined(__linux__)
+// Fills in the address of the abstract Unix socket name, returns its length
+// or 0 if the name doesn't fit.
+inline socklen_t abstractAddress(const std::string &name, sockaddr_un *address) noexcept
+{
+    *address = {};
+    address->sun_family = AF_UNIX;
+    if (name.empty() || name.size() >= sizeof(address->sun_path))
+        return 0;
+    std::memcpy(address->sun_path + 1, name.data(), name.size());
+    return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+}
+#endif
+
+// Receives the descriptors of the data plane. The client listens on an
+// abstract Unix socket and names it in SHARED_MEMORY_ENABLE, the server
+// connects and passes the descriptors with SCM_RIGHTS before it replies.
+// Unlike pidfd_getfd(2) this needs no ptrace access to the server, only a
+// peer of the same user is accepted on either side.
+class DescriptorReceiver
+{
+public:
+    explicit DescriptorReceiver(std::string name)
+        : mName(std::move(name))
+    {
+#if defined(__linux__)
+        sockaddr_un address;
+        const socklen_t length = abstractAddress(mName, &address);
+        if (length == 0) {
+            mError = ENAMETOOLONG;
+            return;
+        }
+        mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (mFd < 0 || bind(mFd, reinterpret_cast<sockaddr *>(&address), length) != 0
+            || listen(mFd, 1) != 0) {
+            mError = errno;
+            closeListener();
+        }
+#else
+        mError = ENOSYS;
+#endif
+    }
+    ~DescriptorReceiver()
+    {
+        closeListener();
+    }
+
+    DescriptorReceiver(const DescriptorReceiver &) = delete;
+    DescriptorReceiver &operator=(const DescriptorReceiver &) = delete;
+
+    [[nodiscard]] bool isListening() const noexcept
+    {
+        return mFd >= 0;
+    }
+    // Why listening failed.
+    [[nodiscard]] int error() const noexcept
+    {
+        return mError;
+    }
+    [[nodiscard]] const std::string &name() const noexcept
+    {
+        return mName;
+    }
+
+    // Waits for the server to pass the descriptors, the caller owns them
+    // afterwards. Returns 0 or the negated errno.
+    int receive(Descriptors *fds, std::chrono::milliseconds timeout)
+    {
+#if defined(__linux__)
+        if (mFd < 0)
+            return -mError;
+        pollfd pfd = { mFd, POLLIN, 0 };
+        const int ready = poll(&pfd, 1, static_cast<int>(timeout.count()));
+        if (ready <= 0)
+            return ready == 0 ? -ETIMEDOUT : -errno;
+        const int connection = accept4(mFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0)
+            return -errno;
+        const int result = receiveFrom(connection, fds, timeout);
+        close(connection);
+        return result;
+#else
+        (void) fds;
+        (void) timeout;
+        return -ENOSYS;
+#endif
+    }
+
+private:
+#if defined(__linux__)
+    static int receiveFrom(int connection, Descriptors *fds, std::chrono::milliseconds timeout)
+    {
+        ucred peer = {};
+        socklen_t peerLength = sizeof(peer);
+        if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0)
+            return -errno;
+        if (peer.uid != geteuid())
+            return -EPERM;
+
+        pollfd pfd = { connection, POLLIN, 0 };
+        const int ready = poll(&pfd, 1, static_cast<int>(timeout.count()));
+        if (ready <= 0)
+            return ready == 0 ? -ETIMEDOUT : -errno;
+
+        char byte = 0;
+        iovec data = { &byte, sizeof(byte) };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(Descriptors))] = {};
+        msghdr message = {};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(connection, &message, MSG_CMSG_CLOEXEC) <= 0)
+            return errno != 0 ? -errno : -EPROTO;
+
+        const cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            return -EPROTO;
+        const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        std::memcpy(fds->data(), CMSG_DATA(header), std::min(count, fds->size()) * sizeof(int));
+        if (count != fds->size() || (message.msg_flags & MSG_CTRUNC) != 0) {
+            for (size_t i = 0; i < std::min(count, fds->size()); ++i)
+                close((*fds)[i]);
+            return -EPROTO;
+        }
+        return 0;
+    }
+#endif
+
+    void closeListener() noexcept
+    {
+#if defined(__linux__)
+        if (mFd >= 0)
+            close(mFd);
+#endif
+        mFd = -1;
+    }
+
+    std::string mName;
+    int mFd = -1;
+    int mError = 0;
+};
+
+class RingReader
+{
+public:
+    enum class Result { Empty, Record, Overrun };
+
+    RingReader() = default;
+    ~RingReader()
+    {
+        detach();
+    }
+
+    RingReader(const RingReader &) = delete;
+    RingReader &operator=(const RingReader &) = delete;
+
+    static constexpr uint64_t CurrentHead = ~uint64_t(0);
+
+    // Maps the ring read-only and takes ownership of the descriptors, as
+    // received by DescriptorReceiver. Reading starts at start, usually the
+    // position announced by the server.
+    bool attach(const Descriptors &fds, size_t size, uint64_t start = CurrentHead)
+    {
+        detach();
+        mFds = fds;
+#if defined(__linux__)
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, mFds[MemoryFd], 0);
+        void *sleepers = mmap(nullptr, SleepersSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+            mFds[SleepersFd], 0);
+        mMapped = mapped != MAP_FAILED ? mapped : nullptr;
+        mSize = size;
+        mSleepers = sleepers != MAP_FAILED ? static_cast<SleeperHeader *>(sleepers) : nullptr;
+        const auto *header = static_cast<const RingHeader *>(mMapped);
+        if (!mMapped || !mSleepers || size < DataOffset || header->magic != RingMagic
+            || header->version != RingVersion || header->capacity > size - DataOffset
+            || !std::has_single_bit(header->capacity)) {
+            detach();
+            return false;
+        }
+        // Captured once, a writer can't change it under the reader's feet.
+        mHeader = header;
+        mCapacity = header->capacity;
+        mData = static_cast<const std::byte *>(mapped) + DataOffset;
+        mMask = mCapacity - 1;
+        mCursor = start == CurrentHead ? mHeader->head.load(std::memory_order_acquire) : start;
+        return true;
+#else
+        (void) size;
+        (void) start;
+        detach();
+        return false;
+#endif
+    }
+
+    void detach()
+    {
+#if defined(__linux__)
+        if (mMapped)
+            munmap(mMapped, mSize);
+        if (mSleepers)
+            munmap(mSleepers, SleepersSize);
+        for (const int fd : mFds) {
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+        mMapped = nullptr;
+        mSleepers = nullptr;
+        mHeader = nullptr;
+        mFds = { -1, -1, -1 };
+    }
+
+    [[nodiscard]] bool isAttached() const noexcept
+    {
+        return mHeader != nullptr;
+    }
+
+    // Copies the payload of the next record into out. Overrun means records
+    // were lost, the cursor has been moved to the current head.
+    Result tryRead(std::string *out)
+    {
+        while (true) {
+            const uint64_t head = mHeader->head.load(std::memory_order_acquire);
+            if (mCursor == head)
+                return Result::Empty;
+            if (head - mCursor > mCapacity)
+                return resync(head);
+
+            const uint64_t offset = mCursor & mMask;
+            RecordHeader record;
+            std::memcpy(&record, mData + offset, sizeof(record));
+            const bool isPadding = record.size == PaddingRecord;
+            const uint64_t length = isPadding ? mCapacity - offset : recordSize(record.size);
+            if (!isPadding) {
+                if (offset + length > mCapacity)
+                    return resync(head);
+                out->assign(reinterpret_cast<const char *>(mData + offset + sizeof(record)),
+                    record.size);
+            }
+            // The writer may have reached this record while it was copied.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mHeader->reserved.load(std::memory_order_relaxed) - mCursor > mCapacity)
+                return resync(mHeader->head.load(std::memory_order_acquire));
+            mCursor += length;
+            if (!isPadding)
+                return Result::Record;
+        }
+    }
+
+    // Parks on the doorbell until the writer published something new or the
+    // timeout expired. Returns true if a record may be available.
+    bool wait(std::chrono::milliseconds timeout)
+    {
+#if defined(__linux__)
+        mSleepers->count.fetch_add(1, std::memory_order_seq_cst);
+        bool ready = mHeader->head.load(std::memory_order_seq_cst) != mCursor;
+        if (!ready && mFds[DoorbellFd] >= 0) {
+            pollfd pfd = { mFds[DoorbellFd], POLLIN, 0 };
+            ready = poll(&pfd, 1, static_cast<int>(timeout.count())) > 0;
+            if (ready) {
+                uint64_t count = 0;
+                [[maybe_unused]] const auto n = read(mFds[DoorbellFd], &count, sizeof(count));
+            }
+        }
+        mSleepers->count.fetch_sub(1, std::memory_order_seq_cst);
+        return ready || mHeader->head.load(std::memory_order_acquire) != mCursor;
+#else
+        (void) timeout;
+        return false;
+#endif
+    }
+
+    [[nodiscard]] int doorbellFd() const noexcept
+    {
+        return mFds[DoorbellFd];
+    }
+
+private:
+    Result resync(uint64_t head)
+    {
+        mCursor = head;
+        return Result::Overrun;
+    }
+
+    void *mMapped = nullptr;
+    size_t mSize = 0;
+    Descriptors mFds = { -1, -1, -1 };
+    SleeperHeader *mSleepers = nullptr;
+    const RingHeader *mHeader = nullptr;
+    uint64_t mCapacity = 0;
+    const std::byte *mData = nullptr;
+    uint64_t mMask = 0;
+    uint64_t mCursor = 0;
+};
+
+} // namespace shm
+
+CLAP_RPC_END_NAMESPACE
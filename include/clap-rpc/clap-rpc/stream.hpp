@@ -4,26 +4,91 @@
 #pragma once
 
 #include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/coalescingtable.hpp>
+#include <clap-rpc/coroutine.hpp>
 #include <clap-rpc/global.hpp>
+#include <clap-rpc/messagepool.hpp>
+#include <clap-rpc/metrics.hpp>
+#include <clap-rpc/outboundring.hpp>
+#include <clap-rpc/server.hpp>
 #include <clap-rpc/streamhandler.hpp>
 
+#include <grpcpp/support/byte_buffer.h>
 #include <grpcpp/support/server_callback.h>
 
-#include <queue>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 
 CLAP_RPC_BEGIN_NAMESPACE
 
-class Stream final : public grpc::ServerBidiReactor<api::ClientMessage, api::ServerMessage>
+class HandlerRegistry;
+struct Subscription;
+
+// Links a stream to a StreamHandler. An EventStream has a single route with
+// tag 0, a multiplexed stream one per subscribed plugin under the tag the
+// client chose. Handlers broadcast to the routes of their streams, so routes
+// are reclaimed through the Epoch like the streams themselves.
+struct StreamRoute
+{
+    ~StreamRoute();
+
+    Stream *stream = nullptr;
+    std::shared_ptr<StreamHandler> handler;
+    uint32_t tag = 0;
+    // Events the client asked for, nullptr for all of them. Replaced by the
+    // read callback, read by broadcasts under an epoch pin.
+    std::atomic<const Subscription *> subscription = nullptr;
+    // Position in the handler's stream list, guarded by its mutex.
+    size_t index = 0;
+};
+
+// Streams exchange raw ByteBuffers. Outgoing messages are serialized once by
+// the StreamHandler and every Stream writes a reference to the same slices.
+// Broadcasting threads hand buffers to the gRPC callback thread through
+// lock-free rings. Whichever thread clears mIsWriting owns the write side,
+// and writes followed by further pending ones are sent with a buffer hint so
+// bursts leave in as few frames as possible.
+class Stream final : public grpc::ServerBidiReactor<grpc::ByteBuffer, grpc::ByteBuffer>
 {
 public:
     explicit Stream(grpc::CallbackServerContext *context, std::shared_ptr<StreamHandler> handler,
-        grpc::Status status);
+        grpc::Status status, StreamLimits limits = {});
+    // A multiplexed stream, subscribing to the handlers found in handlers.
+    explicit Stream(grpc::CallbackServerContext *context, const HandlerRegistry *handlers,
+        StreamLimits limits = {});
+    ~Stream() override;
 
-    void StartSharedWrite(std::shared_ptr<api::ServerMessage> response);
+    [[nodiscard]] bool isMultiplexed() const noexcept
+    {
+        return mHandlers != nullptr;
+    }
+
+    // Writes the buffer or queues it behind the write in flight. Once the
+    // queue is full the configured SlowConsumerPolicy applies.
+    // The completion, if any, is released once the message was written or
+    // dropped.
+    void StartSharedWrite(const grpc::ByteBuffer &buffer, MessageLane lane,
+        CoalescingKey key = {}, std::shared_ptr<WriteCompletion> completion = {});
     void Cancel() const;
 
+    // Messages waiting behind the write in flight.
+    [[nodiscard]] size_t queueDepth() const noexcept
+    {
+        return mQueueDepth.load(std::memory_order_relaxed);
+    }
+    // Messages dropped or replaced because the client didn't keep up.
+    [[nodiscard]] uint64_t droppedMessages() const noexcept
+    {
+        return mDroppedMessages.load(std::memory_order_relaxed);
+    }
+    [[nodiscard]] StreamStats stats() const noexcept;
+
     const api::ClientMessage &clientMessage() const &
     {
         return mClientMessage;
@@ -36,14 +101,101 @@ protected:
     void OnWriteDone(bool ok) override;
 
 private:
+    // With a coalescing entry, the write is a placeholder for whatever is
+    // stored in that entry of mCoalesced once it is popped.
+    struct PendingWrite
+    {
+        grpc::ByteBuffer buffer;
+        uint32_t coalescingEntry = CoalescingTable<64>::InvalidEntry;
+        MessageLane lane = MessageLane::Realtime;
+        std::shared_ptr<WriteCompletion> completion;
+        std::chrono::steady_clock::time_point queuedAt = {};
+    };
+    using Ring = OutboundRing<PendingWrite>;
+    // Room for the latest write of every entry plus those being replaced.
+    using LatestWrites = MessagePool<PendingWrite, 2 * CoalescingTable<64>::capacity()>;
+    static_assert(MessageLaneCount == 3);
+
+    Stream(grpc::CallbackServerContext *context, StreamLimits limits);
+
+    void queueWrite(const grpc::ByteBuffer &buffer, MessageLane lane, CoalescingKey key,
+        std::shared_ptr<WriteCompletion> &&completion);
+    void queueControl(grpc::ByteBuffer &&buffer);
+    bool makeRoom();
+    void writeNext();
+    void finish(grpc::Status status);
+    // Pops from the lanes [first, last), highest first.
+    bool popNext(PendingWrite *write, size_t first = 0, size_t last = MessageLaneCount);
+    // Replaces a placeholder with its latest write. False if there is none.
+    bool resolve(PendingWrite *write);
+    void releaseLatest(LatestWrites::Handle handle);
+    void handleClientMessage(StreamRoute &route);
+    void handleTransport(StreamRoute &route, const api::transport::Client &request);
+    void updateSubscription(StreamRoute &route, const api::event::Client &request);
+
+    void link(uint32_t tag, std::shared_ptr<StreamHandler> &&handler);
+    void unlink(StreamRoute *route);
+    bool readMultiplexed();
+    // Returns the reason if the plugin can't be subscribed.
+    std::string_view subscribePlugin(uint32_t tag, uint64_t pluginId);
+    void replyStatus(uint32_t tag, std::string_view error);
+
+    // Other threads only touch the call while inside the gate. Closing it
+    // waits for the threads inside, it is closed before the call finishes.
+    [[nodiscard]] bool enterGate() const noexcept;
+    void leaveGate() const noexcept;
+    void closeGate() noexcept;
+    // Called once unlinked from all handlers, releases what is still queued.
+    void detach();
+
+    static constexpr uint64_t SharedMemoryOff = ~uint64_t(0);
+    static constexpr uint32_t GateClosed = 0x8000'0000u;
+
+    grpc::ByteBuffer mReadBuffer;
     api::ClientMessage mClientMessage;
 
-    std::shared_ptr<api::ServerMessage> mServerMessage;
-    std::queue<std::shared_ptr<api::ServerMessage>> mServerBuffer;
-    std::atomic<bool> mIsWriting = false;
+    const StreamLimits mLimits;
+    std::array<Ring, MessageLaneCount> mServerBuffers;
+    // The latest write per coalescing key. Its placeholder keeps the place
+    // in the ring, newer writes replace it in place. Preallocated, replacing
+    // a write never allocates.
+    CoalescingTable<64> mLatest;
+    LatestWrites mLatestWrites;
+    std::array<std::atomic<LatestWrites::Handle>, CoalescingTable<64>::capacity()> mCoalesced;
+
+    // Owned by the thread that set mIsWriting.
+    grpc::ByteBuffer mWriteBuffer;
+    std::shared_ptr<WriteCompletion> mWriteCompletion;
+    // Unset for control replies, which aren't counted.
+    std::chrono::steady_clock::time_point mWriteQueuedAt = {};
+    std::optional<PendingWrite> mLookahead;
+    alignas(CacheLineSize) std::atomic<bool> mIsWriting = false;
+    std::atomic<bool> mIsCancelled = false;
+    // Set by a producer inside the gate, which cancels once it left.
+    std::atomic<bool> mIsCancelRequested = false;
+    std::atomic<bool> mIsFinished = false;
+    // Threads inside the gate, GateClosed once the call is finishing.
+    mutable std::atomic<uint32_t> mGate = 0;
+
+    std::atomic<size_t> mQueueDepth = 0;
+    std::atomic<uint64_t> mDroppedMessages = 0;
+    Counter mWrittenMessages;
+    LatencyHistogram mWriteLatency;
+
+    // Replies to requests of this client, written before any lane.
+    MpMcQueue<grpc::ByteBuffer, 8> mControl;
+
+    // Ring position from which realtime messages are read from shared memory.
+    std::atomic<uint64_t> mSharedMemoryStart = SharedMemoryOff;
+    int mDoorbellFd = -1;
+
+    // By tag, only touched from the read callback and OnDone.
+    std::unordered_map<uint32_t, StreamRoute *> mRoutes;
+    const HandlerRegistry *mHandlers = nullptr;
 
     grpc::CallbackServerContext *mContext;
-    std::shared_ptr<StreamHandler> mHandler;
+
+    friend class StreamHandler;
 };
 
 CLAP_RPC_END_NAMESPACE
@@ -4,23 +4,102 @@
 #pragma once
 
 #include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/coalescingtable.hpp>
+#include <clap-rpc/coroutine.hpp>
 #include <clap-rpc/global.hpp>
+#include <clap-rpc/metrics.hpp>
 #include <clap-rpc/mpmcqueue.hpp>
+#include <clap-rpc/pooledmessage.hpp>
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <deque>
 #include <functional>
 #include <memory>
-#include <set>
-#include <shared_mutex>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
 
 CLAP_RPC_BEGIN_NAMESPACE
 
 class Server;
+class StreamHandler;
 class Stream;
+struct StreamRoute;
+class DispatchWorker;
+class SharedMemoryRing;
+class Doorbell;
+
+// Outgoing messages are queued in lanes of descending priority. Dispatch and
+// the per-stream writes always serve the realtime lane first, so events don't
+// wait behind state updates or bulk replies. Auto picks the lane from the
+// message type, see StreamHandler::laneFor.
+enum class MessageLane : uint8_t {
+    Realtime = 0,
+    State,
+    Bulk,
+    Auto,
+};
+inline constexpr size_t MessageLaneCount = 3;
+
+// Awaitables returned by StreamHandler. The handler must outlive them.
+class ClientMessageAwaiter
+{
+public:
+    ClientMessageAwaiter(StreamHandler *handler, Executor *executor)
+        : mHandler(handler), mExecutor(executor)
+    {
+    }
+
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> handle);
+    api::ClientMessage await_resume() noexcept
+    {
+        return std::move(mMessage);
+    }
+
+private:
+    StreamHandler *mHandler;
+    Executor *mExecutor;
+    api::ClientMessage mMessage;
+};
+
+class SendAwaiter
+{
+public:
+    SendAwaiter(StreamHandler *handler, Executor *executor, api::ServerMessage &&message,
+        MessageLane lane)
+        : mHandler(handler), mExecutor(executor), mMessage(std::move(message)), mLane(lane)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<> handle);
+    // Number of streams the message was written to.
+    size_t await_resume() const noexcept
+    {
+        return mWritten;
+    }
+
+private:
+    StreamHandler *mHandler;
+    Executor *mExecutor;
+    api::ServerMessage mMessage;
+    MessageLane mLane;
+    size_t mWritten = 0;
+};
 
 class StreamHandler : public std::enable_shared_from_this<StreamHandler>
 {
-    using ClientQueue = MpMcQueue<api::ClientMessage, 256>;
-    using ServerQueue = MpMcQueue<api::ServerMessage, 256>;
+    using ClientQueue = MpMcQueue<api::ClientMessage, 256, QueueLayout::Interleaved>;
+    using ServerQueue = ServerMessagePool::HandleQueue;
+    using CoalescingSlots = CoalescingTable<256>;
 
 public:
     using OnReadCallback = std::function<bool(const Stream &)>;
@@ -32,39 +111,179 @@ public:
     {
         return mId;
     }
-    [[nodiscard]] size_t numStreams() const noexcept
-    {
-        return mStreams.size();
-    }
+    [[nodiscard]] size_t numStreams() const noexcept;
+    // Multiplexed streams carry other plugins as well and aren't cancelled.
     void cancelAll() const;
+    [[nodiscard]] std::vector<StreamStats> streamStats() const;
+    // Counters of this handler and its streams.
+    [[nodiscard]] HandlerStats stats() const;
 
     void setInterceptor(std::function<bool(const Stream &)> &&callback);
 
-    void pushMessage(api::ServerMessage &&response);
-    void pushMessage(const api::ServerMessage &response);
-    void broadcast(api::ServerMessage &&message);
+    // Returns a preallocated message that can be filled and published from
+    // the audio thread without allocating. If all slots are pending, the
+    // oldest pending message is dropped and its slot reused, or a reserve
+    // slot handed out if the dropped one has to be recycled by the dispatch
+    // worker first. Empty only if that is needed while the reserve is out.
+    [[nodiscard]] PooledMessage acquireMessage();
+    // With a key, a message replaces the pending message of the same key in
+    // place instead of taking another queue entry, so bursts of e.g.
+    // automation only cost one entry per distinct parameter.
+    void pushMessage(PooledMessage &&response, CoalescingKey key = {},
+        MessageLane lane = MessageLane::Auto);
+    void pushMessage(api::ServerMessage &&response, CoalescingKey key = {},
+        MessageLane lane = MessageLane::Auto);
+    void pushMessage(const api::ServerMessage &response, CoalescingKey key = {},
+        MessageLane lane = MessageLane::Auto);
+    // Moves all responses into the queue at once, e.g. one audio block.
+    void pushMessages(std::span<api::ServerMessage> responses,
+        MessageLane lane = MessageLane::Auto);
+
+    // Collects the events of one process() call into a single EventBatch
+    // message, so a block costs one queue slot, one dispatch and one write.
+    // Events are built in the arena of the pooled message; a batch outgrowing
+    // the initial arena block allocates. Committing an empty batch drops it.
+    [[nodiscard]] PooledMessage openBatch(int64_t steadyTime, uint32_t framesCount);
+    static api::event::EventMessage *appendEvent(PooledMessage &batch);
+    bool commitBatch(PooledMessage &&batch);
+
+    // Serializes the message once and writes it to all connected streams.
+    // Events are skipped for streams that unsubscribed from them, a batch is
+    // reserialized for a stream that only wants some of its events. The same
+    // holds for shared memory readers: events not all of them want in full
+    // bypass the ring and go to those that want them over their stream.
+    void broadcast(api::ServerMessage &&message, MessageLane lane = MessageLane::Auto,
+        CoalescingKey key = {});
+    void broadcast(const api::ServerMessage &message, MessageLane lane = MessageLane::Auto,
+        CoalescingKey key = {});
+
+    // Events other than transport updates are realtime, plugin and GUI
+    // messages as well as the transport are state, everything else is bulk.
+    [[nodiscard]] static MessageLane laneFor(const api::ServerMessage &message) noexcept;
 
     bool tryPop(api::ClientMessage *message);
+    // Moves up to messages.size() pending messages out, returns the count.
+    size_t tryPop(std::span<api::ClientMessage> messages);
+    // Blocks until a client message arrived. The reading stream wakes the
+    // consumer directly, there is no polling interval.
     api::ClientMessage pop();
+    // As pop(), but gives up after timeout or at deadline. Returns false then.
+    bool popFor(api::ClientMessage *message, std::chrono::nanoseconds timeout);
+    bool popUntil(api::ClientMessage *message, std::chrono::steady_clock::time_point deadline);
+
+    // An eventfd that becomes readable when client messages arrive, for
+    // integrating with an event loop. Read 8 bytes to reset it, then drain
+    // the messages with tryPop. Created on first use, owned by the handler.
+    // -1 where eventfd isn't available.
+    [[nodiscard]] int clientMessageFd();
+
+    // Awaitable versions of pop() and broadcast(). The awaiting coroutine is
+    // handed to executor from the gRPC read or write callback that completed
+    // the operation. send() is broadcast by the dispatch worker, completes
+    // once every stream wrote or dropped the message and yields the number
+    // of streams it was written to. With the InlineExecutor a dropped message
+    // resumes the coroutine on the dispatch worker. Without streams, or with
+    // too many sends pending, send() yields 0 without suspending.
+    [[nodiscard]] ClientMessageAwaiter nextClientMessage(
+        Executor &executor = InlineExecutor::instance());
+    [[nodiscard]] SendAwaiter send(api::ServerMessage message,
+        Executor &executor = InlineExecutor::instance(), MessageLane lane = MessageLane::Auto);
 
 private:
-    explicit StreamHandler(Server *server);
-    void connect(std::unique_ptr<Stream> &&client);
-    bool disconnect(Stream *client);
+    StreamHandler(Server *server, size_t messagePoolSize);
+    // Queue entries with this bit set refer to a coalescing table entry.
+    static constexpr ServerMessagePool::Handle CoalescedTag = 0x8000'0000u;
+    static_assert(ServerMessagePool::capacity() < CoalescedTag
+        && CoalescingSlots::capacity() < CoalescedTag);
+
+    ServerMessagePool::Handle resolve(ServerMessagePool::Handle entry);
+    void dispatch(ServerMessagePool::Handle entry, MessageLane lane);
+    void broadcast(const api::ServerMessage &message, MessageLane lane, CoalescingKey key,
+        const std::shared_ptr<WriteCompletion> &completion);
+    // Sends are queued by SendAwaiter and broadcast on the dispatch worker.
+    struct PendingSend;
+    bool queueSend(PendingSend &send);
+    void dispatchSends();
+    void pushClientMessage(api::ClientMessage &&message);
+    bool addClientWaiter(std::coroutine_handle<> handle, Executor *executor,
+        api::ClientMessage *message);
+    void resumeClientWaiters();
+    void connect(StreamRoute *route);
+    bool disconnect(StreamRoute *route);
+
+    // Called from the stream's read callback on a transport request.
+    bool enableSharedMemory(Stream *stream, const std::string &socket,
+        api::transport::Server *reply);
+    void disableSharedMemory(Stream *stream);
 
 private:
     uint64_t mId = 0;
-    std::set<std::unique_ptr<Stream>> mStreams;
-    mutable std::shared_mutex mSharedStreamsMtx;
+    // Immutable snapshot of the routes to the connected streams. Readers
+    // iterate it under an epoch pin without locking, connect and disconnect
+    // publish a copy under mStreamsMtx and retire the previous one.
+    std::atomic<const std::vector<StreamRoute *> *> mStreams = nullptr;
+    std::mutex mStreamsMtx;
 
     ClientQueue mClientQueue;
-    ServerQueue mServerQueue;
+    std::unique_ptr<Doorbell> mClientDoorbell;
+    std::atomic<int> mClientMessageFd = -1;
+
+    struct ClientWaiter
+    {
+        std::coroutine_handle<> handle;
+        Executor *executor;
+        api::ClientMessage *message;
+    };
+    std::deque<ClientWaiter> mClientWaiters;
+    std::mutex mClientWaitersMtx;
+    std::atomic<size_t> mNumClientWaiters = 0;
+    ServerMessagePool mServerPool;
+    std::array<ServerQueue, MessageLaneCount> mServerQueues;
+
+    // A send() waiting for the dispatch worker. The message lives in the
+    // awaiter, which stays suspended until the completion is released.
+    struct PendingSend
+    {
+        const api::ServerMessage *message = nullptr;
+        MessageLane lane = MessageLane::Auto;
+        std::shared_ptr<WriteCompletion> completion;
+    };
+    MpMcQueue<PendingSend, 64> mSends;
+    CoalescingSlots mCoalescing;
     OnReadCallback mOnReadCallback;
 
     Server *mServer;
 
+    // Shared memory data plane, created on the first request. 0 disables it.
+    size_t mSharedMemorySize = 0;
+    std::unique_ptr<SharedMemoryRing> mSharedMemory;
+    std::mutex mSharedMemoryMtx;
+    std::atomic<size_t> mSharedMemoryStreams = 0;
+
+    // Producers, the dispatch worker and the reading streams each update
+    // their own cache line.
+    struct Metrics
+    {
+        alignas(CacheLineSize) Counter pushed;
+        Counter coalesced;
+        Counter dropped;
+        alignas(CacheLineSize) Counter dispatched;
+        LatencyHistogram broadcastTime;
+        alignas(CacheLineSize) Counter clientMessages;
+    };
+    Metrics mMetrics;
+
+    // Dispatch bookkeeping, owned by the DispatchWorker of shard mShard.
+    size_t mShard = 0;
+    std::atomic<bool> mIsReady = false;
+    StreamHandler *mNextReady = nullptr;
+    std::shared_ptr<StreamHandler> mReadyRef;
+
     friend class Stream;
     friend class ClapService;
+    friend class DispatchWorker;
+    friend class ClientMessageAwaiter;
+    friend class SendAwaiter;
 };
 
 CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+
+#include <cstdint>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// How an idle dispatch worker waits for new messages. It busy-spins for
+// spinCount iterations, yields yieldCount times and then parks in the kernel.
+struct WaitStrategy
+{
+    uint32_t spinCount = 256;
+    uint32_t yieldCount = 16;
+};
+
+CLAP_RPC_END_NAMESPACE
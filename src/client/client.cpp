@@ -0,0 +1,410 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include <clap-rpc/api/clapservice.grpc.pb.h>
+#include <clap-rpc/client/client.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/support/client_callback.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+class ClientStream;
+
+class ClientPrivate
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t ReceiveQueueSize = 4096;
+
+    explicit ClientPrivate(ClientConfig &&config);
+    ~ClientPrivate();
+
+    void start(std::shared_ptr<ClientStream> stream);
+    void receive(uint64_t pluginId, api::ServerMessage &&message);
+    void onDone(ClientStream *stream, bool wasConnected);
+    void reconnectLoop(const std::stop_token &stoken);
+
+    struct Entry
+    {
+        std::shared_ptr<ClientStream> stream;
+        std::chrono::milliseconds delay = {};
+        Clock::time_point retryAt = {};
+    };
+
+    const ClientConfig mConfig;
+    std::shared_ptr<grpc::Channel> mChannel;
+    std::unique_ptr<api::ClapService::Stub> mStub;
+
+    mutable std::mutex mMtx;
+    std::condition_variable mCv;
+    std::unordered_map<uint64_t, Entry> mStreams;
+    size_t mActiveStreams = 0;
+    bool mIsStopping = false;
+
+    MpMcQueue<ReceivedMessage, ReceiveQueueSize> mReceived;
+    std::unordered_map<int, Client::Callback> mCallbacks;
+    std::vector<ReceivedMessage> mPollBuffer;
+    std::atomic<uint64_t> mDroppedMessages = 0;
+    std::atomic<uint64_t> mReconnects = 0;
+
+    std::jthread mReconnector;
+};
+
+// One EventStream. It owns itself from start() until OnDone. A hold keeps
+// the call alive while writes may still be started from outside the
+// reactions, so StartWrite never races with OnDone.
+class ClientStream final : public grpc::ClientBidiReactor<api::ClientMessage, api::ServerMessage>
+{
+public:
+    ClientStream(ClientPrivate *client, uint64_t pluginId)
+        : mClient(client), mPluginId(pluginId)
+    {
+    }
+
+    void start(std::shared_ptr<ClientStream> self)
+    {
+        mSelf = std::move(self);
+        mContext.AddMetadata("plugin_id", std::to_string(mPluginId));
+        // Wait for the server instead of failing while it (re)starts.
+        mContext.set_wait_for_ready(true);
+        mClient->mStub->async()->EventStream(&mContext, this);
+        AddHold();
+        StartRead(&mRead);
+        StartCall();
+    }
+
+    bool write(const api::ClientMessage &message)
+    {
+        {
+            std::scoped_lock lock(mMtx);
+            if (mIsClosed || !mIsConnected)
+                return false;
+            if (mIsWriting) {
+                mWrites.push_back(message);
+                return true;
+            }
+            mIsWriting = true;
+            mWriting = message;
+        }
+        // Outside the lock, the reaction may run inline.
+        StartWrite(&mWriting);
+        return true;
+    }
+
+    void cancel()
+    {
+        mContext.TryCancel();
+    }
+
+    [[nodiscard]] uint64_t pluginId() const noexcept
+    {
+        return mPluginId;
+    }
+    [[nodiscard]] bool isConnected() const
+    {
+        std::scoped_lock lock(mMtx);
+        return mIsConnected && !mIsClosed;
+    }
+
+    void OnReadInitialMetadataDone(bool ok) override
+    {
+        std::scoped_lock lock(mMtx);
+        mIsConnected = ok;
+    }
+
+    void OnReadDone(bool ok) override
+    {
+        if (!ok) {
+            close();
+            return;
+        }
+        mClient->receive(mPluginId, std::move(mRead));
+        mRead.Clear();
+        StartRead(&mRead);
+    }
+
+    void OnWriteDone(bool ok) override
+    {
+        bool release = false;
+        {
+            std::scoped_lock lock(mMtx);
+            mIsClosed |= !ok;
+            if (!mIsClosed && !mWrites.empty()) {
+                mWriting = std::move(mWrites.front());
+                mWrites.pop_front();
+            } else {
+                mIsWriting = false;
+                if (!mIsClosed)
+                    return;
+                mWrites.clear();
+                release = !std::exchange(mIsHoldReleased, true);
+            }
+        }
+        if (release)
+            RemoveHold();
+        else
+            StartWrite(&mWriting);
+    }
+
+    void OnDone(const grpc::Status &) override
+    {
+        bool wasConnected = false;
+        {
+            std::scoped_lock lock(mMtx);
+            wasConnected = mIsConnected;
+        }
+        mClient->onDone(this, wasConnected);
+        mSelf.reset(); // may delete this
+    }
+
+private:
+    void close()
+    {
+        bool release = false;
+        {
+            std::scoped_lock lock(mMtx);
+            mIsClosed = true;
+            release = !mIsWriting && !std::exchange(mIsHoldReleased, true);
+        }
+        if (release)
+            RemoveHold();
+    }
+
+    ClientPrivate *mClient;
+    const uint64_t mPluginId;
+    std::shared_ptr<ClientStream> mSelf;
+    grpc::ClientContext mContext;
+    api::ServerMessage mRead;
+
+    mutable std::mutex mMtx;
+    std::deque<api::ClientMessage> mWrites;
+    api::ClientMessage mWriting;
+    bool mIsWriting = false;
+    bool mIsConnected = false;
+    bool mIsClosed = false;
+    bool mIsHoldReleased = false;
+};
+
+ClientPrivate::ClientPrivate(ClientConfig &&config)
+    : mConfig(std::move(config))
+{
+    grpc::ChannelArguments args;
+    if (mConfig.maxReceiveMessageSize >= 0)
+        args.SetMaxReceiveMessageSize(mConfig.maxReceiveMessageSize);
+    mChannel = grpc::CreateCustomChannel(mConfig.uri, grpc::InsecureChannelCredentials(), args);
+    mStub = api::ClapService::NewStub(mChannel);
+    mPollBuffer.resize(256);
+    mReconnector = std::jthread([this](std::stop_token stoken) { reconnectLoop(stoken); });
+}
+
+ClientPrivate::~ClientPrivate()
+{
+    std::vector<std::shared_ptr<ClientStream>> streams;
+    {
+        std::unique_lock lock(mMtx);
+        mIsStopping = true;
+        for (auto &[id, entry] : mStreams) {
+            if (entry.stream)
+                streams.emplace_back(std::move(entry.stream));
+        }
+        mStreams.clear();
+    }
+    mReconnector.request_stop();
+    mCv.notify_all();
+    mReconnector.join();
+
+    for (const auto &stream : streams)
+        stream->cancel();
+    streams.clear();
+    // The reactors reference this until OnDone.
+    std::unique_lock lock(mMtx);
+    mCv.wait(lock, [this] { return mActiveStreams == 0; });
+}
+
+void ClientPrivate::start(std::shared_ptr<ClientStream> stream)
+{
+    auto *reactor = stream.get();
+    reactor->start(std::move(stream));
+}
+
+void ClientPrivate::receive(uint64_t pluginId, api::ServerMessage &&message)
+{
+    if (mReceived.tryEmplace(pluginId, std::move(message)))
+        return;
+    mDroppedMessages.fetch_add(1, std::memory_order_relaxed);
+    mReceived.emplace(pluginId, std::move(message));
+}
+
+void ClientPrivate::onDone(ClientStream *stream, bool wasConnected)
+{
+    std::scoped_lock lock(mMtx);
+    --mActiveStreams;
+    const auto it = mStreams.find(stream->pluginId());
+    if (!mIsStopping && it != mStreams.end() && it->second.stream.get() == stream) {
+        auto &entry = it->second;
+        entry.stream.reset();
+        // A stream that was up is reopened right away, failed attempts back
+        // off.
+        if (wasConnected)
+            entry.delay = {};
+        entry.retryAt = Clock::now() + entry.delay;
+        entry.delay = std::clamp(entry.delay * 2, mConfig.reconnectDelay,
+            mConfig.maxReconnectDelay);
+    }
+    mCv.notify_all();
+}
+
+void ClientPrivate::reconnectLoop(const std::stop_token &stoken)
+{
+    std::unique_lock lock(mMtx);
+    while (!stoken.stop_requested()) {
+        auto wakeAt = Clock::time_point::max();
+        const auto now = Clock::now();
+        std::vector<std::shared_ptr<ClientStream>> due;
+        for (auto &[id, entry] : mStreams) {
+            if (entry.stream)
+                continue;
+            if (entry.retryAt <= now) {
+                entry.stream = std::make_shared<ClientStream>(this, id);
+                due.emplace_back(entry.stream);
+                ++mActiveStreams;
+            } else {
+                wakeAt = std::min(wakeAt, entry.retryAt);
+            }
+        }
+        if (!due.empty()) {
+            lock.unlock();
+            for (auto &stream : due)
+                start(std::move(stream));
+            mReconnects.fetch_add(due.size(), std::memory_order_relaxed);
+            lock.lock();
+            continue;
+        }
+        if (wakeAt == Clock::time_point::max())
+            mCv.wait(lock);
+        else
+            mCv.wait_until(lock, wakeAt);
+    }
+}
+
+Client::Client(ClientConfig config)
+    : dPtr(std::make_unique<ClientPrivate>(std::move(config)))
+{
+}
+
+Client::~Client() = default;
+
+bool Client::connect(uint64_t pluginId)
+{
+    std::shared_ptr<ClientStream> stream;
+    {
+        std::scoped_lock lock(dPtr->mMtx);
+        if (dPtr->mStreams.contains(pluginId))
+            return false;
+        stream = std::make_shared<ClientStream>(dPtr.get(), pluginId);
+        dPtr->mStreams[pluginId].stream = stream;
+        ++dPtr->mActiveStreams;
+    }
+    dPtr->start(std::move(stream));
+    return true;
+}
+
+void Client::disconnect(uint64_t pluginId)
+{
+    std::shared_ptr<ClientStream> stream;
+    {
+        std::scoped_lock lock(dPtr->mMtx);
+        const auto it = dPtr->mStreams.find(pluginId);
+        if (it == dPtr->mStreams.end())
+            return;
+        stream = std::move(it->second.stream);
+        dPtr->mStreams.erase(it);
+    }
+    if (stream)
+        stream->cancel();
+}
+
+bool Client::isConnected(uint64_t pluginId) const
+{
+    std::shared_ptr<ClientStream> stream;
+    {
+        std::scoped_lock lock(dPtr->mMtx);
+        const auto it = dPtr->mStreams.find(pluginId);
+        if (it == dPtr->mStreams.end())
+            return false;
+        stream = it->second.stream;
+    }
+    return stream && stream->isConnected();
+}
+
+bool Client::send(uint64_t pluginId, const api::ClientMessage &message)
+{
+    std::shared_ptr<ClientStream> stream;
+    {
+        std::scoped_lock lock(dPtr->mMtx);
+        const auto it = dPtr->mStreams.find(pluginId);
+        if (it == dPtr->mStreams.end())
+            return false;
+        stream = it->second.stream;
+    }
+    return stream && stream->write(message);
+}
+
+bool Client::tryPop(ReceivedMessage *message)
+{
+    return dPtr->mReceived.pop(message);
+}
+
+size_t Client::tryPop(std::span<ReceivedMessage> messages)
+{
+    return dPtr->mReceived.popN(messages.begin(), messages.size());
+}
+
+void Client::on(api::ServerMessage::DataCase type, Callback &&callback)
+{
+    dPtr->mCallbacks[type] = std::move(callback);
+}
+
+size_t Client::poll(size_t maxMessages)
+{
+    auto &buffer = dPtr->mPollBuffer;
+    size_t total = 0;
+    while (total < maxMessages) {
+        const size_t count = tryPop(
+            std::span(buffer).first(std::min(buffer.size(), maxMessages - total)));
+        for (size_t i = 0; i < count; ++i) {
+            const auto it = dPtr->mCallbacks.find(buffer[i].message.data_case());
+            if (it != dPtr->mCallbacks.end())
+                it->second(buffer[i].pluginId, buffer[i].message);
+        }
+        total += count;
+        if (count < buffer.size())
+            break;
+    }
+    return total;
+}
+
+uint64_t Client::droppedMessages() const noexcept
+{
+    return dPtr->mDroppedMessages.load(std::memory_order_relaxed);
+}
+
+uint64_t Client::reconnects() const noexcept
+{
+    return dPtr->mReconnects.load(std::memory_order_relaxed);
+}
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "dispatchworker.h"
+#include "logging.h"
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+DispatchWorker::DispatchWorker(size_t index, WaitStrategy strategy)
+    : mIndex(index), mStrategy(strategy)
+{
+}
+
+DispatchWorker::~DispatchWorker()
+{
+    stop();
+}
+
+bool DispatchWorker::start()
+{
+    if (mThread.joinable())
+        return false;
+    mThread = std::jthread([this](std::stop_token stoken) { run(std::move(stoken)); });
+    return true;
+}
+
+bool DispatchWorker::stop()
+{
+    if (!mThread.joinable())
+        return false;
+    mThread.request_stop();
+    mThread.join();
+    // Drop the references of handlers that were scheduled but never dispatched.
+    releaseReady();
+    return true;
+}
+
+bool DispatchWorker::schedule(StreamHandler *handler)
+{
+    if (handler->mIsReady.exchange(true, std::memory_order_acq_rel))
+        return false; // already linked, the worker will pick up the new messages
+
+    // Keep the handler alive until it has been dispatched. This only bumps
+    // the reference count as the producer owns a reference itself.
+    handler->mReadyRef = handler->shared_from_this();
+
+    StreamHandler *head = mReadyHead.load(std::memory_order_relaxed);
+    do {
+        handler->mNextReady = head;
+    } while (!mReadyHead.compare_exchange_weak(head, handler, std::memory_order_release,
+        std::memory_order_relaxed));
+
+    // Only the transition from an empty list needs to wake the worker.
+    if (head == nullptr)
+        mDoorbell.ring();
+    return true;
+}
+
+void DispatchWorker::run(std::stop_token stoken)
+{
+    Log(DEBUG, "worker thread {} initialized", mIndex);
+    std::stop_callback onStop(stoken, [this] { mDoorbell.ring(); });
+    while (!stoken.stop_requested()) {
+        mDoorbell.wait(stoken, mStrategy, [this] {
+            return mReadyHead.load(std::memory_order_acquire) != nullptr;
+        });
+
+        mWakeups.add();
+        StreamHandler *handler = takeReady();
+        while (handler) {
+            StreamHandler *next = handler->mNextReady;
+            dispatch(handler);
+            handler = next;
+        }
+    }
+    Log(DEBUG, "worker thread {} finished", mIndex);
+}
+
+void DispatchWorker::dispatch(StreamHandler *handler)
+{
+    // Take over the reference before clearing the ready flag. Producers may
+    // re-link the handler as soon as the flag is cleared.
+    auto sharedHandler = std::move(handler->mReadyRef);
+    handler->mNextReady = nullptr;
+    handler->mIsReady.store(false, std::memory_order_release);
+    mDispatchedHandlers.add();
+    // Slots given up on the producer side are recycled here, freeing arena
+    // blocks is not for the audio thread.
+    sharedHandler->mServerPool.reclaim([](ArenaMessage &slot) { slot.recycle(); });
+    sharedHandler->dispatchSends();
+
+    // Realtime messages are taken in batches. Lower lanes are served one
+    // message at a time, so realtime messages pushed meanwhile don't have to
+    // wait behind a whole batch of bulk messages.
+    while (true) {
+        size_t lane = 0;
+        size_t count = 0;
+        for (; lane < MessageLaneCount && count == 0; ++lane) {
+            const size_t batchSize = lane == size_t(MessageLane::Realtime) ? mBatch.size() : 1;
+            count = sharedHandler->mServerQueues[lane].popN(mBatch.begin(), batchSize);
+        }
+        if (count == 0)
+            break;
+        mDispatchedMessages.add(count);
+        for (size_t i = 0; i < count; ++i)
+            sharedHandler->dispatch(mBatch[i], MessageLane(lane - 1));
+    }
+}
+
+WorkerStats DispatchWorker::stats() const noexcept
+{
+    return {
+        .wakeups = mWakeups.value(),
+        .parks = mDoorbell.waits(),
+        .kernelWakes = mDoorbell.wakes(),
+        .dispatchedHandlers = mDispatchedHandlers.value(),
+        .dispatchedMessages = mDispatchedMessages.value(),
+    };
+}
+
+StreamHandler *DispatchWorker::takeReady()
+{
+    // The list is built LIFO, reverse it so handlers are served in the order
+    // they became ready.
+    StreamHandler *head = mReadyHead.exchange(nullptr, std::memory_order_acquire);
+    StreamHandler *reversed = nullptr;
+    while (head) {
+        StreamHandler *next = head->mNextReady;
+        head->mNextReady = reversed;
+        reversed = head;
+        head = next;
+    }
+    return reversed;
+}
+
+void DispatchWorker::releaseReady()
+{
+    StreamHandler *handler = takeReady();
+    while (handler) {
+        StreamHandler *next = handler->mNextReady;
+        auto sharedHandler = std::move(handler->mReadyRef);
+        handler->mNextReady = nullptr;
+        handler->mIsReady.store(false, std::memory_order_release);
+        handler = next;
+    }
+}
+
+CLAP_RPC_END_NAMESPACE
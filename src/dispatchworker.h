@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include "doorbell.h"
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/metrics.hpp>
+#include <clap-rpc/server.hpp>
+#include <clap-rpc/streamhandler.hpp>
+
+#include <array>
+#include <atomic>
+#include <thread>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// A dispatch worker owns a shard of StreamHandlers. Handlers with pending
+// messages are linked into its lock-free ready list by the producer, so a
+// wakeup only touches handlers that actually have work to do.
+class DispatchWorker
+{
+public:
+    explicit DispatchWorker(size_t index, WaitStrategy strategy = {});
+    ~DispatchWorker();
+
+    DispatchWorker(const DispatchWorker &) = delete;
+    DispatchWorker &operator=(const DispatchWorker &) = delete;
+
+    DispatchWorker(DispatchWorker &&) = delete;
+    DispatchWorker &operator=(DispatchWorker &&) = delete;
+
+    bool start();
+    bool stop();
+
+    // Marks the handler as ready. Only the first call after the worker has
+    // picked up the handler links it into the list. Lock-free and safe to
+    // call from the audio thread.
+    bool schedule(StreamHandler *handler);
+
+    [[nodiscard]] WorkerStats stats() const noexcept;
+
+private:
+    void run(std::stop_token stoken);
+    void dispatch(StreamHandler *handler);
+    StreamHandler *takeReady();
+    void releaseReady();
+
+    static constexpr size_t BatchSize = 64;
+
+    const size_t mIndex;
+    const WaitStrategy mStrategy;
+    std::array<ServerMessagePool::Handle, BatchSize> mBatch;
+    alignas(64) std::atomic<StreamHandler *> mReadyHead = nullptr;
+    Doorbell mDoorbell;
+
+    // Only written by the worker thread.
+    Counter mWakeups;
+    Counter mDispatchedHandlers;
+    Counter mDispatchedMessages;
+
+    std::jthread mThread;
+};
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "doorbell.h"
+
+#include <algorithm>
+
+#if defined(__linux__)
+  #include <ctime>
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+using namespace std::chrono_literals;
+
+#if defined(__linux__)
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bit");
+
+void Doorbell::wake() noexcept
+{
+    // FUTEX_WAKE never blocks, it only hands the waiter back to the scheduler.
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&mSequence), FUTEX_WAKE_PRIVATE, 1, nullptr,
+        nullptr, 0);
+}
+
+void Doorbell::park(uint32_t sequence) noexcept
+{
+    // Returns immediately if the sequence moved on since it was sampled.
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&mSequence), FUTEX_WAIT_PRIVATE, sequence,
+        nullptr, nullptr, 0);
+}
+
+void Doorbell::park(uint32_t sequence, std::chrono::nanoseconds timeout) noexcept
+{
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    const timespec relative = { static_cast<time_t>(seconds.count()),
+        static_cast<long>((timeout - seconds).count()) };
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&mSequence), FUTEX_WAIT_PRIVATE, sequence,
+        &relative, nullptr, 0);
+}
+
+#else
+
+void Doorbell::wake() noexcept
+{
+    mSequence.notify_one();
+}
+
+void Doorbell::park(uint32_t sequence) noexcept
+{
+    mSequence.wait(sequence, std::memory_order_seq_cst);
+}
+
+void Doorbell::park(uint32_t sequence, std::chrono::nanoseconds timeout) noexcept
+{
+    // std::atomic can't wait with a timeout, poll in short steps instead.
+    if (mSequence.load(std::memory_order_seq_cst) == sequence)
+        std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, 1ms));
+}
+
+#endif
+
+CLAP_RPC_END_NAMESPACE
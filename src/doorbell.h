@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/metrics.hpp>
+#include <clap-rpc/waitstrategy.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stop_token>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+  #include <immintrin.h>
+#endif
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+inline void cpuRelax() noexcept
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// An event count used to wake a consumer thread from realtime producers.
+// ring() never takes a lock and only enters the kernel (a non-blocking
+// futex wake) if the consumer is actually parked. The consumer spins, then
+// yields and finally parks, as configured by the WaitStrategy.
+class Doorbell
+{
+public:
+    Doorbell() = default;
+
+    Doorbell(const Doorbell &) = delete;
+    Doorbell &operator=(const Doorbell &) = delete;
+
+    void ring() noexcept
+    {
+        mSequence.fetch_add(1, std::memory_order_seq_cst);
+        if (mWaiters.load(std::memory_order_seq_cst) != 0) {
+            mWakes.add();
+            wake();
+        }
+    }
+
+    // Times a consumer announced it is about to park, and kernel wakes issued
+    // by ring(). A wake is only issued while a consumer is announced.
+    [[nodiscard]] uint64_t waits() const noexcept
+    {
+        return mWaits.value();
+    }
+    [[nodiscard]] uint64_t wakes() const noexcept
+    {
+        return mWakes.value();
+    }
+
+    // Returns once hasWork() returned true or a stop was requested.
+    template <typename Predicate>
+    void wait(const std::stop_token &stoken, const WaitStrategy &strategy, Predicate &&hasWork)
+    {
+        for (uint32_t i = 0; i < strategy.spinCount; ++i) {
+            if (hasWork() || stoken.stop_requested())
+                return;
+            cpuRelax();
+        }
+        for (uint32_t i = 0; i < strategy.yieldCount; ++i) {
+            if (hasWork() || stoken.stop_requested())
+                return;
+            std::this_thread::yield();
+        }
+        while (!stoken.stop_requested()) {
+            mWaiters.fetch_add(1, std::memory_order_seq_cst);
+            mWaits.add();
+            const uint32_t sequence = mSequence.load(std::memory_order_seq_cst);
+            if (hasWork() || stoken.stop_requested()) {
+                mWaiters.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+            park(sequence);
+            mWaiters.fetch_sub(1, std::memory_order_relaxed);
+            if (hasWork())
+                return;
+        }
+    }
+
+    // Parks right away until tryTake() succeeded or the deadline passed, for
+    // consumers that aren't latency critical. tryTake() is called once per
+    // wake up and usually consumes the work, so it also suits several
+    // consumers. Returns false on timeout.
+    template <typename Predicate>
+    bool waitUntil(std::chrono::steady_clock::time_point deadline, Predicate &&tryTake)
+    {
+        using Clock = std::chrono::steady_clock;
+        while (true) {
+            mWaiters.fetch_add(1, std::memory_order_seq_cst);
+            mWaits.add();
+            const uint32_t sequence = mSequence.load(std::memory_order_seq_cst);
+            if (tryTake()) {
+                mWaiters.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            const auto now = Clock::now();
+            if (now >= deadline) {
+                mWaiters.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (deadline == Clock::time_point::max())
+                park(sequence);
+            else
+                park(sequence, deadline - now);
+            mWaiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    void wake() noexcept;
+    void park(uint32_t sequence) noexcept;
+    void park(uint32_t sequence, std::chrono::nanoseconds timeout) noexcept;
+
+    alignas(64) std::atomic<uint32_t> mSequence = 0;
+    std::atomic<uint32_t> mWaiters = 0;
+    Counter mWaits;
+    Counter mWakes;
+};
+
+CLAP_RPC_END_NAMESPACE
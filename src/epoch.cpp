@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "epoch.h"
+
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+namespace detail {
+
+struct EpochRecord
+{
+    static constexpr uint64_t Idle = ~uint64_t(0);
+
+    alignas(CacheLineSize) std::atomic<uint64_t> epoch = Idle;
+    std::atomic<bool> isUsed = true;
+    EpochRecord *next = nullptr;
+};
+
+} // namespace detail
+
+namespace {
+
+using Record = detail::EpochRecord;
+
+std::atomic<uint64_t> sEpoch = 0;
+// Records are never freed, threads that exit leave theirs for reuse.
+std::atomic<Record *> sRecords = nullptr;
+
+struct Retired
+{
+    void *object;
+    void (*deleter)(void *);
+    uint64_t epoch;
+};
+std::mutex sRetiredMtx;
+std::vector<Retired> sRetired;
+
+Record *acquireRecord()
+{
+    for (auto *record = sRecords.load(std::memory_order_acquire); record; record = record->next) {
+        bool isUsed = false;
+        if (record->isUsed.compare_exchange_strong(isUsed, true, std::memory_order_acquire))
+            return record;
+    }
+    auto *record = new Record;
+    record->next = sRecords.load(std::memory_order_relaxed);
+    while (!sRecords.compare_exchange_weak(record->next, record, std::memory_order_release,
+        std::memory_order_relaxed))
+        ;
+    return record;
+}
+
+struct ThreadState
+{
+    ~ThreadState()
+    {
+        if (record)
+            record->isUsed.store(false, std::memory_order_release);
+    }
+    Record *record = nullptr;
+    uint32_t depth = 0;
+};
+thread_local ThreadState tState;
+
+// The epoch moves on once every pinned reader has seen the current one.
+bool tryAdvance(uint64_t epoch)
+{
+    for (auto *record = sRecords.load(std::memory_order_acquire); record; record = record->next) {
+        const uint64_t pinned = record->epoch.load(std::memory_order_seq_cst);
+        if (pinned != Record::Idle && pinned != epoch)
+            return false;
+    }
+    return sEpoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+}
+
+} // namespace
+
+Epoch::Guard::~Guard()
+{
+    if (mRecord && --tState.depth == 0)
+        mRecord->epoch.store(Record::Idle, std::memory_order_release);
+}
+
+Epoch::Guard::Guard(Guard &&other) noexcept
+    : mRecord(std::exchange(other.mRecord, nullptr))
+{
+}
+
+Epoch::Guard Epoch::pin() noexcept
+{
+    auto &state = tState;
+    if (state.depth++ != 0)
+        return Guard(state.record);
+    if (!state.record)
+        state.record = acquireRecord();
+    // Publish the epoch, then make sure it didn't move on meanwhile. Pointers
+    // loaded afterwards are protected.
+    uint64_t epoch = sEpoch.load(std::memory_order_seq_cst);
+    while (true) {
+        state.record->epoch.store(epoch, std::memory_order_seq_cst);
+        const uint64_t current = sEpoch.load(std::memory_order_seq_cst);
+        if (current == epoch)
+            break;
+        epoch = current;
+    }
+    return Guard(state.record);
+}
+
+void Epoch::retire(void *object, void (*deleter)(void *))
+{
+    {
+        std::scoped_lock lock(sRetiredMtx);
+        sRetired.push_back({ object, deleter, sEpoch.load(std::memory_order_seq_cst) });
+    }
+    collect();
+}
+
+void Epoch::collect()
+{
+    std::vector<Retired> ready;
+    {
+        std::scoped_lock lock(sRetiredMtx);
+        if (sRetired.empty())
+            return;
+        // Without pinned readers both advances succeed and everything retired
+        // so far is deleted right away.
+        for (int i = 0; i < 2; ++i) {
+            if (!tryAdvance(sEpoch.load(std::memory_order_seq_cst)))
+                break;
+        }
+        // Readers pinned at epoch e may still see objects retired at e. Once
+        // the epoch is two further, all of them have left.
+        const uint64_t epoch = sEpoch.load(std::memory_order_seq_cst);
+        const auto isSafe = [epoch](const Retired &r) { return r.epoch + 2 <= epoch; };
+        for (const auto &retired : sRetired) {
+            if (isSafe(retired))
+                ready.push_back(retired);
+        }
+        std::erase_if(sRetired, isSafe);
+    }
+    // Outside the lock, deleters may retire further objects.
+    for (const auto &retired : ready)
+        retired.deleter(retired.object);
+}
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+namespace detail {
+struct EpochRecord;
+} // namespace detail
+
+// Epoch based reclamation for read-mostly structures. Readers pin the
+// current epoch while they follow pointers into a structure. Writers unlink
+// objects and retire them. A retired object is deleted once every reader
+// pinned at that time has left, which takes two epoch advances.
+//
+// Pinning costs two stores to a per-thread record and never blocks. The
+// first pin of a thread allocates its record, records of exited threads are
+// reused. Retiring takes a lock and is meant for insertions and removals,
+// not for hot paths.
+class Epoch
+{
+    using Record = detail::EpochRecord;
+
+public:
+    class Guard
+    {
+    public:
+        Guard() = default;
+        ~Guard();
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        Guard(Guard &&other) noexcept;
+        Guard &operator=(Guard &&) = delete;
+
+    private:
+        explicit Guard(Record *record)
+            : mRecord(record)
+        {
+        }
+
+        Record *mRecord = nullptr;
+        friend class Epoch;
+    };
+
+    // Pins may nest, only the outermost one publishes the epoch.
+    [[nodiscard]] static Guard pin() noexcept;
+
+    static void retire(void *object, void (*deleter)(void *));
+    template <typename T>
+    static void retire(T *object)
+    {
+        retire(const_cast<void *>(static_cast<const void *>(object)),
+            [](void *p) { delete static_cast<T *>(p); });
+    }
+
+    // Deletes what can be deleted right now. Called by retire.
+    static void collect();
+};
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "handlerregistry.h"
+
+#include <random>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+HandlerRegistry::HandlerRegistry()
+    : mKey((uint64_t(std::random_device{}()) << 32) | std::random_device{}())
+{
+}
+
+HandlerRegistry::~HandlerRegistry()
+{
+    // Nobody looks up anymore, free without going through the epoch.
+    for (auto &chunk : mChunks) {
+        auto *slots = chunk.load(std::memory_order_relaxed);
+        if (!slots)
+            continue;
+        for (auto &s : *slots)
+            delete s.entry.load(std::memory_order_relaxed);
+        delete slots;
+    }
+}
+
+HandlerRegistry::Slot *HandlerRegistry::slot(uint32_t index) const noexcept
+{
+    if (index >= mSize.load(std::memory_order_acquire))
+        return nullptr;
+    auto *chunk = mChunks[index / ChunkSize].load(std::memory_order_acquire);
+    return chunk ? &(*chunk)[index % ChunkSize] : nullptr;
+}
+
+// splitmix64 finalizer over the keyed index.
+uint32_t HandlerRegistry::mask(uint32_t index) const noexcept
+{
+    uint64_t x = mKey ^ index;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<uint32_t>(x ^ (x >> 31));
+}
+
+uint64_t HandlerRegistry::insert(const std::shared_ptr<StreamHandler> &handler)
+{
+    std::scoped_lock lock(mMtx);
+    uint32_t index = 0;
+    if (!mFree.empty()) {
+        index = mFree.back();
+        mFree.pop_back();
+    } else {
+        index = mSize.load(std::memory_order_relaxed);
+        if (index == capacity())
+            return InvalidId;
+        auto &chunk = mChunks[index / ChunkSize];
+        if (!chunk.load(std::memory_order_relaxed))
+            chunk.store(new Chunk, std::memory_order_release);
+        mSize.store(index + 1, std::memory_order_release);
+    }
+
+    auto &s = (*mChunks[index / ChunkSize].load(std::memory_order_relaxed))[index % ChunkSize];
+    // The generation that masks to 0 is skipped, so no ID is ever InvalidId.
+    if ((++s.generation ^ mask(index)) == 0)
+        ++s.generation;
+    const uint64_t id = (uint64_t(s.generation ^ mask(index)) << 32) | index;
+    s.entry.store(new Entry{ id, handler }, std::memory_order_release);
+    return id;
+}
+
+bool HandlerRegistry::erase(uint64_t id)
+{
+    const auto index = static_cast<uint32_t>(id);
+    const Entry *entry = nullptr;
+    {
+        std::scoped_lock lock(mMtx);
+        auto *s = slot(index);
+        if (!s)
+            return false;
+        entry = s->entry.load(std::memory_order_relaxed);
+        if (!entry || entry->id != id)
+            return false;
+        s->entry.store(nullptr, std::memory_order_release);
+        mFree.push_back(index);
+    }
+    Epoch::retire(entry);
+    return true;
+}
+
+std::shared_ptr<StreamHandler> HandlerRegistry::find(uint64_t id) const
+{
+    const auto *s = slot(static_cast<uint32_t>(id));
+    if (!s)
+        return nullptr;
+    const auto guard = Epoch::pin();
+    const auto *entry = s->entry.load(std::memory_order_acquire);
+    if (!entry || entry->id != id)
+        return nullptr;
+    return entry->handler.lock();
+}
+
+std::vector<std::shared_ptr<StreamHandler>> HandlerRegistry::handlers() const
+{
+    std::vector<std::shared_ptr<StreamHandler>> result;
+    const auto guard = Epoch::pin();
+    const uint32_t size = mSize.load(std::memory_order_acquire);
+    for (uint32_t index = 0; index < size; ++index) {
+        const auto *entry = slot(index)->entry.load(std::memory_order_acquire);
+        if (!entry)
+            continue;
+        if (auto handler = entry->handler.lock())
+            result.emplace_back(std::move(handler));
+    }
+    return result;
+}
+
+CLAP_RPC_END_NAMESPACE
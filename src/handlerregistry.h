@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include "epoch.h"
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/streamhandler.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Maps handler IDs to live StreamHandlers. An ID is the slot index in the
+// low and the slot's generation in the high 32 bits, so a lookup is a direct
+// index without hashing or locking. The generation is xored with a mask
+// derived from a per-registry random key and the index, so the ID of another
+// client's handler can't be guessed from sequential slots. This is not a
+// secret: the ID is the only check on EventStream, use TLS or a local
+// transport where that matters. Slots are allocated in chunks that never
+// move. Insert and erase take a short lock for the free list, the entries
+// they unlink are reclaimed through the Epoch.
+class HandlerRegistry
+{
+public:
+    static constexpr size_t ChunkSize = 256;
+    static constexpr size_t MaxChunks = 256;
+    static constexpr uint64_t InvalidId = 0;
+
+    HandlerRegistry();
+    ~HandlerRegistry();
+
+    HandlerRegistry(const HandlerRegistry &) = delete;
+    HandlerRegistry &operator=(const HandlerRegistry &) = delete;
+
+    // Returns the ID of the handler, InvalidId if all slots are taken.
+    uint64_t insert(const std::shared_ptr<StreamHandler> &handler);
+    // Only removes the entry if the ID is still current.
+    bool erase(uint64_t id);
+    // Lock-free. Empty if the ID is unknown, stale or the handler is gone.
+    [[nodiscard]] std::shared_ptr<StreamHandler> find(uint64_t id) const;
+    // Collects the live handlers.
+    [[nodiscard]] std::vector<std::shared_ptr<StreamHandler>> handlers() const;
+
+    [[nodiscard]] static constexpr size_t capacity() noexcept
+    {
+        return ChunkSize * MaxChunks;
+    }
+
+private:
+    // Immutable once published.
+    struct Entry
+    {
+        uint64_t id;
+        std::weak_ptr<StreamHandler> handler;
+    };
+    struct Slot
+    {
+        std::atomic<const Entry *> entry = nullptr;
+        // Only touched under mMtx.
+        uint32_t generation = 0;
+    };
+    using Chunk = std::array<Slot, ChunkSize>;
+
+    [[nodiscard]] Slot *slot(uint32_t index) const noexcept;
+    [[nodiscard]] uint32_t mask(uint32_t index) const noexcept;
+
+    const uint64_t mKey;
+
+    std::array<std::atomic<Chunk *>, MaxChunks> mChunks = {};
+    std::atomic<uint32_t> mSize = 0;
+
+    std::mutex mMtx;
+    std::vector<uint32_t> mFree;
+};
+
+CLAP_RPC_END_NAMESPACE
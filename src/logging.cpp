@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "logging.h"
+#include "doorbell.h"
+
+#include <clap-rpc/metrics.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+namespace {
+
+struct LogRing
+{
+    MpMcQueue<LogRecord, Logger::RingCapacity> records;
+    std::thread::id thread = std::this_thread::get_id();
+    // Set when the thread exits, the writer drops the ring once it is empty.
+    std::atomic<bool> isAbandoned = false;
+};
+
+// Doesn't touch the Logger, which may already be shut down at thread exit.
+struct RingOwner
+{
+    ~RingOwner()
+    {
+        if (ring)
+            ring->isAbandoned.store(true, std::memory_order_release);
+    }
+    std::shared_ptr<LogRing> ring;
+};
+thread_local RingOwner tRingOwner;
+
+const char *levelName(LogLevel level) noexcept
+{
+    switch (level) {
+    case LogLevel::Debug:
+        return "[DEBUG] ";
+    case LogLevel::Info:
+        return "[INFO] ";
+    case LogLevel::Warning:
+        return "[WARNING] ";
+    case LogLevel::Error:
+        return "[ERROR] ";
+    }
+    return "";
+}
+
+void writeRecord(std::ostream &out, const LogRecord &record, std::thread::id thread)
+{
+    out << "clap::rpc " << levelName(record.level);
+    if (Logger::sShowThread.load(std::memory_order_relaxed))
+        out << "[Thread " << thread << "] ";
+    if (Logger::sShowSourceLocation.load(std::memory_order_relaxed)) {
+        const auto fn = std::string_view(record.location.file_name());
+        const auto shortFile = fn.substr(fn.find_last_of('/') + 1);
+        out << shortFile << " ('" << record.location.function_name() << "'): ";
+    }
+    out << record.formatter(record.format, record.args.data()) << '\n';
+}
+
+class LogWriter
+{
+public:
+    LogWriter()
+    {
+        mThread = std::jthread([this](std::stop_token stoken) { run(stoken); });
+    }
+
+    std::shared_ptr<LogRing> attach()
+    {
+        auto ring = std::make_shared<LogRing>();
+        std::scoped_lock lock(mRingsMtx);
+        mRings.push_back(ring);
+        return ring;
+    }
+
+    void notify() noexcept
+    {
+        mDoorbell.ring();
+    }
+
+    void countDropped() noexcept
+    {
+        mDropped.add();
+    }
+
+    [[nodiscard]] bool isStopped() const noexcept
+    {
+        return mIsStopped.load(std::memory_order_acquire);
+    }
+
+    // Writes on the calling thread once the writer is gone.
+    void writeDirect(const LogRecord &record)
+    {
+        std::scoped_lock lock(mOutputMtx);
+        writeRecord(std::clog, record, std::this_thread::get_id());
+        std::clog.flush();
+    }
+
+    void flush()
+    {
+        std::scoped_lock lock(mRingsMtx);
+        drain();
+    }
+
+    // Called at exit, or when a plugin library is unloaded. Messages logged
+    // afterwards are written synchronously.
+    void stop()
+    {
+        mThread.request_stop();
+        mDoorbell.ring();
+        if (mThread.joinable())
+            mThread.join();
+        mIsStopped.store(true, std::memory_order_release);
+        flush();
+    }
+
+private:
+    void run(const std::stop_token &stoken)
+    {
+        while (!stoken.stop_requested()) {
+            const auto deadline = std::chrono::steady_clock::now() + Logger::FlushInterval;
+            mDoorbell.waitUntil(deadline, [&] {
+                std::scoped_lock lock(mRingsMtx);
+                return drain() || stoken.stop_requested();
+            });
+        }
+    }
+
+    // Returns whether anything was written.
+    bool drain()
+    {
+        std::ostringstream out;
+        bool wrote = false;
+        LogRecord record;
+        for (auto it = mRings.begin(); it != mRings.end();) {
+            auto &ring = *it;
+            const bool isAbandoned = ring->isAbandoned.load(std::memory_order_acquire);
+            while (ring->records.pop(&record)) {
+                writeRecord(out, record, ring->thread);
+                wrote = true;
+            }
+            it = isAbandoned ? mRings.erase(it) : std::next(it);
+        }
+        if (const uint64_t dropped = mDropped.value(); dropped != mReportedDropped) {
+            out << "clap::rpc [WARNING] " << dropped - mReportedDropped
+                << " log messages dropped\n";
+            mReportedDropped = dropped;
+            wrote = true;
+        }
+        if (wrote) {
+            std::scoped_lock lock(mOutputMtx);
+            std::clog << out.str();
+            std::clog.flush();
+        }
+        return wrote;
+    }
+
+    std::mutex mRingsMtx;
+    std::vector<std::shared_ptr<LogRing>> mRings;
+    std::mutex mOutputMtx;
+    Doorbell mDoorbell;
+    Counter mDropped;
+    uint64_t mReportedDropped = 0;
+    std::atomic<bool> mIsStopped = false;
+    std::jthread mThread;
+};
+
+// Never destroyed, threads may log during static destruction.
+LogWriter &writer()
+{
+    static LogWriter *instance = [] {
+        auto *created = new LogWriter;
+        std::atexit([] { writer().stop(); });
+        return created;
+    }();
+    return *instance;
+}
+
+} // namespace
+
+Logger &Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+void Logger::push(const LogRecord &record) noexcept
+{
+    auto &out = writer();
+    if (out.isStopped()) {
+        out.writeDirect(record);
+        return;
+    }
+    auto &ring = tRingOwner.ring;
+    if (!ring)
+        ring = out.attach();
+    if (!ring->records.tryPush(record)) {
+        out.countDropped();
+        return;
+    }
+    // Below the threshold the writer picks the record up on its next round.
+    if (ring->records.size() >= WakeThreshold)
+        out.notify();
+}
+
+void Logger::flush()
+{
+    writer().flush();
+}
+
+CLAP_RPC_END_NAMESPACE
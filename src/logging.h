@@ -5,60 +5,192 @@
 
 #include <clap-rpc/global.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <format>
-#include <iostream>
 #include <source_location>
-#include <thread>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+// Levels below this are compiled out. Debug messages are stripped from
+// release builds unless overridden, e.g. -DCLAP_RPC_MIN_LOG_LEVEL=0.
+#if !defined(CLAP_RPC_MIN_LOG_LEVEL)
+  #if defined(NDEBUG)
+    #define CLAP_RPC_MIN_LOG_LEVEL 1
+  #else
+    #define CLAP_RPC_MIN_LOG_LEVEL 0
+  #endif
+#endif
 
 CLAP_RPC_BEGIN_NAMESPACE
 
-enum LogLevel { INFO = 0, DEBUG, WARNING, ERROR };
+enum class LogLevel : uint8_t { Debug = 0, Info, Warning, Error };
+inline constexpr LogLevel MinLogLevel = LogLevel(CLAP_RPC_MIN_LOG_LEVEL);
+
+template <LogLevel Level>
+struct LogLevelTag
+{
+};
+inline constexpr LogLevelTag<LogLevel::Debug> DEBUG;
+inline constexpr LogLevelTag<LogLevel::Info> INFO;
+inline constexpr LogLevelTag<LogLevel::Warning> WARNING;
+inline constexpr LogLevelTag<LogLevel::Error> ERROR;
+
+// A message as it travels from the logging thread to the writer. Only the
+// format string pointer and copies of the arguments are stored, formatting
+// happens on the writer thread.
+struct LogRecord
+{
+    static constexpr size_t ArgsCapacity = 192;
+    using Formatter = std::string (*)(std::string_view format, const std::byte *args);
+
+    Formatter formatter = nullptr;
+    std::string_view format;
+    std::source_location location;
+    LogLevel level = LogLevel::Info;
+    std::array<std::byte, ArgsCapacity> args;
+};
+
+namespace detail {
+
+// Strings are copied as a 16 bit length followed by the characters and are
+// truncated to what fits. Everything else is copied bytewise.
+template <typename T>
+inline constexpr bool IsLogString = std::is_convertible_v<const T &, std::string_view>;
+
+template <typename T>
+using LogStored = std::conditional_t<IsLogString<T>, std::string_view, std::remove_cvref_t<T>>;
+
+template <typename T>
+constexpr size_t logArgSize() noexcept
+{
+    if constexpr (IsLogString<T>) {
+        return sizeof(uint16_t);
+    } else {
+        static_assert(std::is_trivially_copyable_v<std::remove_cvref_t<T>>,
+            "log arguments must be strings or trivially copyable");
+        return sizeof(std::remove_cvref_t<T>);
+    }
+}
+
+inline void encodeLogArgs(std::byte *, const std::byte *) noexcept { }
+
+template <typename T, typename... Rest>
+void encodeLogArgs(std::byte *pos, const std::byte *end, const T &value, const Rest &...rest)
+{
+    if constexpr (IsLogString<T>) {
+        // Leave room for the arguments that follow.
+        constexpr size_t Reserved = (logArgSize<Rest>() + ... + 0) + sizeof(uint16_t);
+        const std::string_view str(value);
+        const auto room = static_cast<size_t>(end - pos) - Reserved;
+        const auto size = static_cast<uint16_t>(std::min<size_t>({ str.size(), room, 0xffff }));
+        std::memcpy(pos, &size, sizeof(size));
+        std::memcpy(pos + sizeof(size), str.data(), size);
+        pos += sizeof(size) + size;
+    } else {
+        std::memcpy(pos, &value, sizeof(T));
+        pos += sizeof(T);
+    }
+    encodeLogArgs(pos, end, rest...);
+}
+
+template <typename T>
+T decodeLogArg(const std::byte *&pos) noexcept
+{
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        uint16_t size = 0;
+        std::memcpy(&size, pos, sizeof(size));
+        const std::string_view str(reinterpret_cast<const char *>(pos + sizeof(size)), size);
+        pos += sizeof(size) + size;
+        return str;
+    } else {
+        T value;
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+}
 
 template <typename... Args>
-struct Log
+std::string formatLogRecord(std::string_view format, const std::byte *args)
+{
+    // Braced initialization decodes the arguments from left to right.
+    [[maybe_unused]] const std::byte *pos = args;
+    const std::tuple<LogStored<Args>...> values{ decodeLogArg<LogStored<Args>>(pos)... };
+    return std::apply(
+        [format](const auto &...v) { return std::vformat(format, std::make_format_args(v...)); },
+        values);
+}
+
+} // namespace detail
+
+// Every thread logs into its own lock-free ring, a background thread formats
+// and writes the records to std::clog. Logging never blocks: a full ring
+// drops the record and the drop is reported later. The first message of a
+// thread allocates its ring, log once from the audio thread outside of
+// process() to keep it allocation free. The writer drains the rings every
+// FlushInterval, a logging thread only wakes it once its ring fills up.
+class Logger
 {
-    static inline LogLevel sCurrentLevel = INFO;
-    static inline bool SShowThread = true;
-    static inline bool sShowSourceLocation = false;
-    explicit Log(LogLevel level, std::format_string<Args...> fmt, Args &&...args,
-        const std::source_location &loc = std::source_location::current())
+public:
+    static constexpr size_t RingCapacity = 256;
+    static constexpr size_t WakeThreshold = RingCapacity / 4;
+    static constexpr std::chrono::milliseconds FlushInterval{ 10 };
+
+    static Logger &instance();
+
+    static void setLevel(LogLevel level) noexcept
     {
-        if (level < sCurrentLevel)
-            return;
-
-        std::clog << "clap::rpc ";
-
-        const char *lStr = nullptr;
-        switch (level) {
-        case INFO:
-            lStr = "[INFO] ";
-            break;
-        case DEBUG:
-            lStr = "[DEBUG] ";
-            break;
-        case WARNING:
-            lStr = "[WARNING] ";
-            break;
-        case ERROR:
-            lStr = "[ERROR] ";
-            break;
-        }
-        std::clog << lStr;
+        sLevel.store(level, std::memory_order_relaxed);
+    }
+    [[nodiscard]] static LogLevel level() noexcept
+    {
+        return sLevel.load(std::memory_order_relaxed);
+    }
+    static inline std::atomic<bool> sShowThread = true;
+    static inline std::atomic<bool> sShowSourceLocation = false;
 
-        if (SShowThread)
-            std::clog << "[Thread " << std::this_thread::get_id() << "] ";
+    void push(const LogRecord &record) noexcept;
+    // Writes everything logged so far, for tests and shutdown.
+    void flush();
 
-        if (sShowSourceLocation) {
-            const auto fn = std::string_view(loc.file_name());
-            const auto shortFile = fn.substr(fn.find_last_of('/') + 1);
-            std::clog << shortFile << " ('" << loc.function_name() << "'): ";
-        }
+private:
+    Logger() = default;
 
-        std::clog << std::format(std::forward<decltype(fmt)>(fmt), std::forward<Args>(args)...)
-                  << '\n';
+    static inline std::atomic<LogLevel> sLevel = LogLevel::Debug;
+};
+
+template <LogLevel Level, typename... Args>
+struct Log
+{
+    explicit Log(LogLevelTag<Level>, [[maybe_unused]] std::format_string<Args...> fmt,
+        [[maybe_unused]] Args &&...args,
+        [[maybe_unused]] const std::source_location &loc = std::source_location::current())
+    {
+        if constexpr (Level >= MinLogLevel) {
+            static_assert((detail::logArgSize<Args>() + ... + 0) <= LogRecord::ArgsCapacity,
+                "log arguments too large");
+            if (Level < Logger::level())
+                return;
+            LogRecord record;
+            record.formatter = &detail::formatLogRecord<Args...>;
+            record.format = fmt.get();
+            record.location = loc;
+            record.level = Level;
+            detail::encodeLogArgs(record.args.data(), record.args.data() + record.args.size(),
+                args...);
+            Logger::instance().push(record);
+        }
     }
 };
-template <typename... Args>
-Log(LogLevel, std::format_string<Args...>, Args &&...) -> Log<Args...>;
+template <LogLevel Level, typename... Args>
+Log(LogLevelTag<Level>, std::format_string<Args...>, Args &&...) -> Log<Level, Args...>;
 
 CLAP_RPC_END_NAMESPACE
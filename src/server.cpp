@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: MIT
 // Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
 
+#include "dispatchworker.h"
+#include "handlerregistry.h"
 #include "logging.h"
 
 #include <clap-rpc/api/clapservice.grpc.pb.h>
@@ -9,43 +11,123 @@
 #include <clap-rpc/stream.hpp>
 
 #include <google/protobuf/message.h>
+#include <grpc/grpc.h>
 #include <grpc/support/time.h>
+#include <grpcpp/resource_quota.h>
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 
 #include <algorithm>
-#include <condition_variable>
-#include <shared_mutex>
+#include <climits>
 #include <thread>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 CLAP_RPC_BEGIN_NAMESPACE
 
 using namespace std::chrono_literals;
 
 namespace {
-uint64_t toHash(const void *ptr)
+bool isLocalSocket(std::string_view uri)
 {
-    auto h = reinterpret_cast<uint64_t>(ptr);
-    h ^= h >> 33;
-    h *= 0xff'51'af'd7'ed'55'8c'cd;
-    h ^= h >> 33;
-    h *= 0xc4'ce'b9'fe'1a'85'ec'53;
-    return h ^ (h >> 33);
+    return uri.starts_with("unix:") || uri.starts_with("unix-abstract:");
+}
+
+void setIntArgument(grpc::ServerBuilder &builder, const char *name, int64_t value)
+{
+    if (value > 0)
+        builder.AddChannelArgument(name, static_cast<int>(std::min<int64_t>(value, INT_MAX)));
+}
+
+void applyConfig(grpc::ServerBuilder &builder, const ServerConfig &config)
+{
+    if (config.maxReceiveMessageSize >= 0)
+        builder.SetMaxReceiveMessageSize(config.maxReceiveMessageSize);
+    if (config.maxSendMessageSize >= 0)
+        builder.SetMaxSendMessageSize(config.maxSendMessageSize);
+
+    const auto &keepalive = config.keepalive;
+    setIntArgument(builder, GRPC_ARG_KEEPALIVE_TIME_MS, keepalive.time.count());
+    setIntArgument(builder, GRPC_ARG_KEEPALIVE_TIMEOUT_MS, keepalive.timeout.count());
+    if (keepalive.permitWithoutCalls) {
+        builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+        builder.AddChannelArgument(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+    }
+    setIntArgument(builder, GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS,
+        keepalive.minClientPingInterval.count());
+
+    const auto &http2 = config.http2;
+    setIntArgument(builder, GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, http2.streamWindowSize);
+    if (!http2.bdpProbe)
+        builder.AddChannelArgument(GRPC_ARG_HTTP2_BDP_PROBE, 0);
+    setIntArgument(builder, GRPC_ARG_HTTP2_MAX_FRAME_SIZE, http2.maxFrameSize);
+    setIntArgument(builder, GRPC_ARG_HTTP2_WRITE_BUFFER_SIZE, http2.writeBufferSize);
+
+    const auto &resources = config.resources;
+    if (resources.maxThreads > 0 || resources.maxMemory > 0) {
+        grpc::ResourceQuota quota("clap-rpc");
+        if (resources.maxThreads > 0)
+            quota.SetMaxThreads(resources.maxThreads);
+        if (resources.maxMemory > 0)
+            quota.Resize(resources.maxMemory);
+        builder.SetResourceQuota(quota);
+    }
+}
+
+void toProto(const HistogramSnapshot &histogram, api::stats::Histogram *out)
+{
+    out->mutable_buckets()->Assign(histogram.buckets.begin(), histogram.buckets.end());
+    out->set_count(histogram.count);
+    out->set_sum_ns(static_cast<uint64_t>(histogram.sum.count()));
+    out->set_max_ns(static_cast<uint64_t>(histogram.max.count()));
+}
+
+void toProto(const HandlerStats &handler, api::stats::Handler *out)
+{
+    out->set_plugin_id(handler.id);
+    out->set_worker(static_cast<uint32_t>(handler.worker));
+    out->set_pending_messages(handler.pendingMessages);
+    out->set_pending_client_messages(handler.pendingClientMessages);
+    out->set_pushed_messages(handler.pushedMessages);
+    out->set_coalesced_messages(handler.coalescedMessages);
+    out->set_dropped_messages(handler.droppedMessages);
+    out->set_dispatched_messages(handler.dispatchedMessages);
+    out->set_client_messages(handler.clientMessages);
+    out->set_dropped_client_messages(handler.droppedClientMessages);
+    toProto(handler.broadcastTime, out->mutable_broadcast_time());
+    for (const auto &stream : handler.streams) {
+        auto *s = out->add_streams();
+        s->set_queue_depth(stream.queueDepth);
+        s->set_dropped_messages(stream.droppedMessages);
+        s->set_written_messages(stream.writtenMessages);
+        toProto(stream.writeLatency, s->mutable_write_latency());
+    }
 }
 } // namespace
 
-class ClapService final : public api::ClapService::CallbackService
+// The EventStream and MultiplexStream are served raw, outgoing messages are
+// serialized once per StreamHandler instead of once per connected stream.
+class ClapService final
+    : public api::ClapService::WithRawCallbackMethod_MultiplexStream<
+          api::ClapService::WithCallbackMethod_GetStats<
+              api::ClapService::WithRawCallbackMethod_EventStream<api::ClapService::Service>>>
 {
 public:
-    ClapService()
+    explicit ClapService(const ServerConfig &config)
+        : mStreamLimits(config.streamLimits)
+        , mSharedMemoryConfig(config.sharedMemory)
+        , mMessagePoolSize(config.messagePoolSize)
     {
-        assert(startWorker() && "Couldn't start worker");
+        const size_t numWorkers = std::max<size_t>(config.dispatchWorkers, 1);
+        mWorkers.reserve(numWorkers);
+        for (size_t i = 0; i < numWorkers; ++i)
+            mWorkers.emplace_back(std::make_unique<DispatchWorker>(i, config.workerWait));
+        [[maybe_unused]] const bool started = startWorkers();
+        assert(started && "Couldn't start workers");
     }
     ~ClapService() override
     {
-        stopWorker();
+        stopWorkers();
     }
 
     ClapService(const ClapService &) = delete;
@@ -57,84 +139,65 @@ public:
     std::shared_ptr<StreamHandler> createStreamHandler(Server *server)
     {
         auto deleter = [this](StreamHandler *ptr) {
-            std::shared_lock readLock(mSharedHandlersMtx);
-            const auto it = std::ranges::find_if(mActiveHandlers, [ptr](const auto &v) {
-                if (auto shared = v.second.lock(); !shared || shared.get() == ptr)
-                    return true;
-                return false;
-            });
-            if (it != mActiveHandlers.end()) {
-                readLock.unlock();
-                std::unique_lock writeLock(mSharedHandlersMtx);
-                mActiveHandlers.erase(it);
-            }
+            mHandlers.erase(ptr->mId);
             delete ptr;
         };
 
-        std::shared_ptr<StreamHandler> handler(new StreamHandler(server), deleter);
-        handler->mId = toHash(handler.get());
-        Log(INFO, "Registered unique plugin ID: {}", handler->mId);
-
-        std::unique_lock writeLock(mSharedHandlersMtx);
-        mActiveHandlers.insert({ handler->mId, handler });
-
+        std::shared_ptr<StreamHandler> handler(new StreamHandler(server, mMessagePoolSize), deleter);
+        handler->mShard = mNextShard.fetch_add(1, std::memory_order_relaxed) % mWorkers.size();
+        handler->mSharedMemorySize = mSharedMemoryConfig.enabled ? mSharedMemoryConfig.ringSize : 0;
+        handler->mId = mHandlers.insert(handler);
+        if (handler->mId == HandlerRegistry::InvalidId) {
+            Log(ERROR, "Too many plugin instances, at most {}", HandlerRegistry::capacity());
+            return nullptr;
+        }
+        Log(INFO, "Registered unique plugin ID: {} (worker {})", handler->mId, handler->mShard);
         return handler;
     }
 
-    bool startWorker()
+    bool startWorkers()
+    {
+        bool started = true;
+        for (const auto &worker : mWorkers)
+            started &= worker->start();
+        return started;
+    }
+
+    bool stopWorkers()
     {
-        if (mWorker.joinable())
-            return false;
-
-        mWorker = std::jthread([this](std::stop_token stoken) {
-            Log(DEBUG, "worker thread initialized");
-            // TODO: Integrate exponential backoff ? atomic_flag spin-wait?
-            while (!stoken.stop_requested()) {
-                std::unique_lock<std::mutex> waitMtx(mWorkerMtx);
-                mWorkerCV.wait(waitMtx, stoken, [this] { return mWorkerIsReady.load(); });
-                mWorkerIsReady = false;
-
-                api::ServerMessage message;
-
-                std::shared_lock readLock(mSharedHandlersMtx);
-                for (const auto &handler : mActiveHandlers) {
-                    auto sharedHandler = handler.second.lock();
-                    if (!sharedHandler)
-                        continue;
-                    while (sharedHandler->mServerQueue.pop(&message)) {
-                        sharedHandler->broadcast(std::move(message));
-                        message = api::ServerMessage();
-                    }
-                }
-            }
-            Log(DEBUG, "worker thread finished");
-        });
-
-        return true;
+        bool stopped = true;
+        for (const auto &worker : mWorkers)
+            stopped &= worker->stop();
+        return stopped;
     }
 
-    bool stopWorker()
+    bool tryNotifyWorker(StreamHandler *handler)
     {
-        if (!mWorker.joinable())
-            return false;
-        mWorker.request_stop();
-        mWorker.join();
-        return true;
+        return mWorkers[handler->mShard]->schedule(handler);
     }
 
-    bool tryNotifyWorker()
+    // With a pluginId only that handler is included, if it is still alive.
+    ServerStats stats(uint64_t pluginId = 0)
     {
-        bool expected = false;
-        if (!mWorkerIsReady.compare_exchange_strong(expected, true, std::memory_order_acquire))
-            return false;
-        // TODO: This is not realtime safe as it may involve an OS call...
-        // https://timur.audio/using-locks-in-real-time-audio-processing-safely
-        mWorkerCV.notify_one();
-        return true;
+        ServerStats stats;
+        stats.workers.reserve(mWorkers.size());
+        for (const auto &worker : mWorkers)
+            stats.workers.push_back(worker->stats());
+
+        std::vector<std::shared_ptr<StreamHandler>> handlers;
+        if (pluginId == 0) {
+            handlers = mHandlers.handlers();
+        } else if (auto handler = mHandlers.find(pluginId)) {
+            handlers.emplace_back(std::move(handler));
+        }
+        stats.handlers.reserve(handlers.size());
+        for (const auto &handler : handlers)
+            stats.handlers.push_back(handler->stats());
+        return stats;
     }
 
 protected:
-    grpc::ServerBidiReactor<api::ClientMessage, api::ServerMessage> *
+    grpc::ServerBidiReactor<grpc::ByteBuffer, grpc::ByteBuffer> *
         EventStream(grpc::CallbackServerContext *context) override
     {
         // a new connection must provide a plugin_id
@@ -151,32 +214,52 @@ protected:
         const auto hashId = std::stoull(std::string(metaPlugId->second.data(),
             metaPlugId->second.length()));
 
-        std::shared_lock readLock(mSharedHandlersMtx);
-        const auto it = mActiveHandlers.find(hashId);
-        if (it == mActiveHandlers.end()) {
+        const auto sharedHandler = mHandlers.find(hashId);
+        if (!sharedHandler) {
             return new Stream(context, nullptr,
                 {
                     grpc::StatusCode::UNAUTHENTICATED,
                     std::format("plugin_id: '{}' not found", hashId),
                 });
         }
-        readLock.unlock();
+        return new Stream(context, sharedHandler, grpc::Status::OK, mStreamLimits);
+    }
+
+    grpc::ServerBidiReactor<grpc::ByteBuffer, grpc::ByteBuffer> *
+        MultiplexStream(grpc::CallbackServerContext *context) override
+    {
+        // Plugins are subscribed by the client after the stream is open.
+        return new Stream(context, &mHandlers, mStreamLimits);
+    }
+
+    grpc::ServerUnaryReactor *GetStats(grpc::CallbackServerContext *context,
+        const api::stats::Request *request, api::stats::Snapshot *response) override
+    {
+        const auto snapshot = stats(request->plugin_id());
+        for (const auto &worker : snapshot.workers) {
+            auto *w = response->add_workers();
+            w->set_wakeups(worker.wakeups);
+            w->set_dispatched_handlers(worker.dispatchedHandlers);
+            w->set_dispatched_messages(worker.dispatchedMessages);
+            w->set_parks(worker.parks);
+            w->set_kernel_wakes(worker.kernelWakes);
+        }
+        for (const auto &handler : snapshot.handlers)
+            toProto(handler, response->add_handlers());
 
-        const auto sharedHandler = it->second.lock();
-        auto stream = std::make_unique<Stream>(context, sharedHandler, grpc::Status::OK);
-        auto *streamPtr = stream.get();
-        sharedHandler->connect(std::move(stream));
-        return streamPtr;
+        auto *reactor = context->DefaultReactor();
+        reactor->Finish(grpc::Status::OK);
+        return reactor;
     }
 
 private:
-    std::unordered_map<uint64_t, std::weak_ptr<StreamHandler>> mActiveHandlers;
-    std::shared_mutex mSharedHandlersMtx;
+    const StreamLimits mStreamLimits;
+    const SharedMemoryConfig mSharedMemoryConfig;
+    const size_t mMessagePoolSize;
+    HandlerRegistry mHandlers;
 
-    std::jthread mWorker;
-    std::mutex mWorkerMtx;
-    std::condition_variable_any mWorkerCV;
-    std::atomic<bool> mWorkerIsReady{ false };
+    std::vector<std::unique_ptr<DispatchWorker>> mWorkers;
+    std::atomic<size_t> mNextShard = 0;
 };
 
 static std::mutex sUniqueInstanceMtx = {};
@@ -186,10 +269,14 @@ class ServerPrivate
 {
 public:
     explicit ServerPrivate()
+        : clapService(sServerConfig)
     {
         grpc::ServerBuilder builder;
         builder.AddListeningPort(sServerConfig.addressUri, grpc::InsecureServerCredentials(),
             &selectedPort);
+        for (const auto &listener : sServerConfig.extraListeners)
+            builder.AddListeningPort(listener, grpc::InsecureServerCredentials());
+        applyConfig(builder, sServerConfig);
         builder.RegisterService(&clapService);
 
         server = builder.BuildAndStart();
@@ -197,7 +284,13 @@ public:
             Log(ERROR, "Server start failed");
             return;
         }
-        address = sServerConfig.addressUri.substr(0, sServerConfig.addressUri.find_last_of(':'));
+        if (isLocalSocket(sServerConfig.addressUri)) {
+            address = sServerConfig.addressUri;
+            selectedPort = -1;
+        } else {
+            address = sServerConfig.addressUri.substr(0,
+                sServerConfig.addressUri.find_last_of(':'));
+        }
         Log(INFO, "Server listening on URI: {}, Port: {}", address, selectedPort);
         running = true;
     }
@@ -253,6 +346,8 @@ int Server::port() const noexcept
 
 std::string Server::uri() const
 {
+    if (dPtr->selectedPort < 0)
+        return dPtr->address;
     return dPtr->address + ':' + std::to_string(dPtr->selectedPort);
 }
 
@@ -262,7 +357,7 @@ bool Server::stop()
     if (!dPtr->running.compare_exchange_strong(expected, true, std::memory_order_acquire))
         return false;
 
-    dPtr->clapService.stopWorker();
+    dPtr->clapService.stopWorkers();
     dPtr->server->Shutdown();
     Log(DEBUG, "server stopped");
     return true;
@@ -273,9 +368,14 @@ std::shared_ptr<StreamHandler> Server::createStreamHandler()
     return dPtr->clapService.createStreamHandler(this);
 }
 
-bool Server::tryNotify()
+ServerStats Server::stats() const
+{
+    return dPtr->clapService.stats();
+}
+
+bool Server::tryNotify(StreamHandler *handler)
 {
-    return dPtr->clapService.tryNotifyWorker();
+    return dPtr->clapService.tryNotifyWorker(handler);
 }
 
 CLAP_RPC_END_NAMESPACE
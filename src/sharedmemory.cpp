@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "sharedmemory.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+  #include <fcntl.h>
+  #include <sys/eventfd.h>
+  #include <sys/mman.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+#if defined(__linux__)
+
+std::unique_ptr<SharedMemoryRing> SharedMemoryRing::create(size_t capacity)
+{
+    capacity = std::bit_ceil(std::max<size_t>(capacity, 4096));
+    const size_t size = shm::DataOffset + capacity;
+
+    // Failures leave errno set for the caller's reply.
+    void *mapped = MAP_FAILED;
+    void *sleepers = MAP_FAILED;
+    int fd = -1;
+    int sleepersFd = -1;
+    const auto fail = [&](const char *call) {
+        const int error = errno;
+        Log(ERROR, "{} failed: {}", call, strerror(error));
+        if (mapped != MAP_FAILED)
+            munmap(mapped, size);
+        if (sleepers != MAP_FAILED)
+            munmap(sleepers, shm::SleepersSize);
+        for (const int f : { fd, sleepersFd }) {
+            if (f >= 0)
+                close(f);
+        }
+        errno = error;
+        return nullptr;
+    };
+    // Readers may neither resize the memfds nor, where the kernel supports
+    // it, map the ring writable.
+    constexpr int Seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#if defined(F_SEAL_FUTURE_WRITE)
+    constexpr int RingSeals = Seals | F_SEAL_FUTURE_WRITE;
+#else
+    constexpr int RingSeals = Seals;
+#endif
+
+    fd = memfd_create("clap-rpc-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return fail("memfd_create");
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        return fail("ftruncate");
+    mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+        return fail("mmap");
+    if (fcntl(fd, F_ADD_SEALS, RingSeals) != 0 && fcntl(fd, F_ADD_SEALS, Seals) != 0)
+        return fail("fcntl");
+
+    sleepersFd = memfd_create("clap-rpc-sleepers", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (sleepersFd < 0)
+        return fail("memfd_create");
+    if (ftruncate(sleepersFd, shm::SleepersSize) != 0)
+        return fail("ftruncate");
+    sleepers = mmap(nullptr, shm::SleepersSize, PROT_READ | PROT_WRITE, MAP_SHARED, sleepersFd, 0);
+    if (sleepers == MAP_FAILED)
+        return fail("mmap");
+    if (fcntl(sleepersFd, F_ADD_SEALS, Seals) != 0)
+        return fail("fcntl");
+
+    auto *header = new (mapped) shm::RingHeader{};
+    header->magic = shm::RingMagic;
+    header->version = shm::RingVersion;
+    header->capacity = capacity;
+    new (sleepers) shm::SleeperHeader{};
+    return std::unique_ptr<SharedMemoryRing>(
+        new SharedMemoryRing(fd, mapped, size, sleepersFd, sleepers));
+}
+
+SharedMemoryRing::SharedMemoryRing(int memoryFd, void *mapped, size_t size, int sleepersFd,
+    void *sleepers)
+    : mMemoryFd(memoryFd)
+    , mMapped(mapped)
+    , mSize(size)
+    , mCapacity(size - shm::DataOffset)
+    , mSleepersFd(sleepersFd)
+    , mSleepers(static_cast<shm::SleeperHeader *>(sleepers))
+    , mHeader(static_cast<shm::RingHeader *>(mapped))
+    , mData(static_cast<std::byte *>(mapped) + shm::DataOffset)
+{
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+    munmap(mMapped, mSize);
+    munmap(mSleepers, shm::SleepersSize);
+    close(mMemoryFd);
+    close(mSleepersFd);
+}
+
+uint64_t SharedMemoryRing::publish(const google::protobuf::MessageLite &message)
+{
+    const size_t capacity = mCapacity;
+    const size_t payload = message.ByteSizeLong();
+    const size_t length = shm::recordSize(payload);
+    if (length > capacity / 2)
+        return NotPublished;
+
+    uint64_t start = mHead;
+    size_t offset = start & (capacity - 1);
+    const size_t padding = offset + length > capacity ? capacity - offset : 0;
+
+    // Announce the bytes about to be overwritten before touching them.
+    mHeader->reserved.store(start + padding + length, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (padding != 0) {
+        const shm::RecordHeader pad = { shm::PaddingRecord, 0 };
+        std::memcpy(mData + offset, &pad, sizeof(pad));
+        start += padding;
+        offset = 0;
+    }
+    const shm::RecordHeader record = { static_cast<uint32_t>(payload), 0 };
+    std::memcpy(mData + offset, &record, sizeof(record));
+    message.SerializeWithCachedSizesToArray(
+        reinterpret_cast<uint8_t *>(mData + offset + sizeof(record)));
+
+    mHead = start + length;
+    mHeader->head.store(mHead, std::memory_order_seq_cst);
+    return start;
+}
+
+bool SharedMemoryRing::hasSleepers() const noexcept
+{
+    return mSleepers->count.load(std::memory_order_seq_cst) != 0;
+}
+
+int sendDescriptors(const std::string &name, const shm::Descriptors &fds)
+{
+    sockaddr_un address;
+    const socklen_t length = shm::abstractAddress(name, &address);
+    if (length == 0)
+        return ENAMETOOLONG;
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return errno;
+    const auto result = [fd](int error) {
+        close(fd);
+        return error;
+    };
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), length) != 0)
+        return result(errno);
+    // Never hand the ring to another user listening under that name.
+    ucred peer = {};
+    socklen_t peerLength = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0)
+        return result(errno);
+    if (peer.uid != geteuid())
+        return result(EPERM);
+
+    char byte = 0;
+    iovec data = { &byte, sizeof(byte) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(shm::Descriptors))] = {};
+    msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(shm::Descriptors));
+    std::memcpy(CMSG_DATA(header), fds.data(), sizeof(shm::Descriptors));
+    if (sendmsg(fd, &message, MSG_NOSIGNAL) < 0)
+        return result(errno);
+    return result(0);
+}
+
+int createDoorbellFd()
+{
+    return eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+void ringDoorbellFd(int fd)
+{
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto n = write(fd, &one, sizeof(one));
+}
+
+void closeDoorbellFd(int fd)
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+#else
+
+std::unique_ptr<SharedMemoryRing> SharedMemoryRing::create(size_t)
+{
+    errno = ENOSYS;
+    return nullptr;
+}
+
+SharedMemoryRing::~SharedMemoryRing() = default;
+
+uint64_t SharedMemoryRing::publish(const google::protobuf::MessageLite &)
+{
+    return NotPublished;
+}
+
+bool SharedMemoryRing::hasSleepers() const noexcept
+{
+    return false;
+}
+
+int sendDescriptors(const std::string &, const shm::Descriptors &)
+{
+    return ENOSYS;
+}
+
+int createDoorbellFd()
+{
+    return -1;
+}
+
+void ringDoorbellFd(int) { }
+
+void closeDoorbellFd(int) { }
+
+#endif
+
+CLAP_RPC_END_NAMESPACE
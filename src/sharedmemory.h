@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/sharedring.hpp>
+
+#include <google/protobuf/message_lite.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Writer side of the shared memory data plane, see shm::RingHeader. Only
+// available on Linux, create() returns nullptr elsewhere. The memfd is sealed
+// against resizing and new writable mappings, and the writer never trusts
+// anything readers can reach: the capacity is kept privately.
+class SharedMemoryRing
+{
+public:
+    static std::unique_ptr<SharedMemoryRing> create(size_t capacity);
+    ~SharedMemoryRing();
+
+    SharedMemoryRing(const SharedMemoryRing &) = delete;
+    SharedMemoryRing &operator=(const SharedMemoryRing &) = delete;
+
+    static constexpr uint64_t NotPublished = ~uint64_t(0);
+
+    // Serializes the message straight into the ring and returns the position
+    // of its record, or NotPublished if it doesn't fit. Single writer only.
+    uint64_t publish(const google::protobuf::MessageLite &message);
+
+    // Position of the next record.
+    [[nodiscard]] uint64_t head() const noexcept
+    {
+        return mHead;
+    }
+
+    // Whether readers are parked and need their doorbell rung.
+    [[nodiscard]] bool hasSleepers() const noexcept;
+
+    [[nodiscard]] int memoryFd() const noexcept
+    {
+        return mMemoryFd;
+    }
+    [[nodiscard]] int sleepersFd() const noexcept
+    {
+        return mSleepersFd;
+    }
+    [[nodiscard]] size_t mappedSize() const noexcept
+    {
+        return mSize;
+    }
+
+private:
+    SharedMemoryRing(int memoryFd, void *mapped, size_t size, int sleepersFd, void *sleepers);
+
+    int mMemoryFd;
+    void *mMapped;
+    size_t mSize;
+    size_t mCapacity;
+    int mSleepersFd;
+    shm::SleeperHeader *mSleepers;
+    shm::RingHeader *mHeader;
+    std::byte *mData;
+    uint64_t mHead = 0;
+};
+
+// Connects to the abstract Unix socket a shm::DescriptorReceiver listens on
+// and passes the descriptors with SCM_RIGHTS. Returns 0 or an errno value.
+int sendDescriptors(const std::string &name, const shm::Descriptors &fds);
+
+// eventfd used as the doorbell of a single reader.
+int createDoorbellFd();
+void ringDoorbellFd(int fd);
+void closeDoorbellFd(int fd);
+
+CLAP_RPC_END_NAMESPACE
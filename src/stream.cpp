@@ -1,55 +1,358 @@
 // SPDX-License-Identifier: MIT
 // Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
 
+#include "epoch.h"
+#include "handlerregistry.h"
 #include "logging.h"
+#include "sharedmemory.h"
+#include "subscription.h"
+#include "wirebuffer.h"
 
 #include <clap-rpc/stream.hpp>
 
+#include <grpcpp/impl/codegen/proto_utils.h>
 #include <grpcpp/server_context.h>
 
+#include <thread>
+#include <utility>
+
 CLAP_RPC_BEGIN_NAMESPACE
 
+namespace {
+// The stream whose TryCancel() runs on this thread, see Stream::Cancel().
+thread_local const Stream *tCancelling = nullptr;
+} // namespace
+
+StreamRoute::~StreamRoute()
+{
+    delete subscription.load(std::memory_order_acquire);
+}
+
+Stream::Stream(grpc::CallbackServerContext *context, StreamLimits limits)
+    : mLimits(limits)
+    , mServerBuffers{ Ring(limits.maxQueuedMessages), Ring(limits.maxQueuedMessages),
+        Ring(limits.maxQueuedMessages) }
+    , mContext(context)
+{
+    for (auto &latest : mCoalesced)
+        latest.store(LatestWrites::InvalidHandle, std::memory_order_relaxed);
+}
+
 Stream::Stream(grpc::CallbackServerContext *context, std::shared_ptr<StreamHandler> handler,
-    grpc::Status status)
-    : mContext(context), mHandler(std::move(handler))
+    grpc::Status status, StreamLimits limits)
+    : Stream(context, limits)
 {
-    if (!mHandler || !status.ok()) {
-        Finish(std::move(status));
+    if (!handler || !status.ok()) {
+        finish(std::move(status));
         return;
     }
-    StartRead(&mClientMessage);
+    // Tells the client the stream was accepted before anything is written.
+    StartSendInitialMetadata();
+    link(0, std::move(handler));
+    StartRead(&mReadBuffer);
+}
+
+Stream::Stream(grpc::CallbackServerContext *context, const HandlerRegistry *handlers,
+    StreamLimits limits)
+    : Stream(context, limits)
+{
+    mHandlers = handlers;
+    StartSendInitialMetadata();
+    StartRead(&mReadBuffer);
 }
 
-void Stream::StartSharedWrite(std::shared_ptr<api::ServerMessage> response)
+Stream::~Stream()
 {
-    bool expected = false;
-    if (mIsWriting.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
-        mServerMessage = std::move(response);
-        StartWrite(mServerMessage.get());
+    closeDoorbellFd(mDoorbellFd);
+}
+
+void Stream::StartSharedWrite(const grpc::ByteBuffer &buffer, MessageLane lane,
+    CoalescingKey key, std::shared_ptr<WriteCompletion> completion)
+{
+    // A broadcast may still hold this stream after it was disconnected.
+    if (!enterGate())
+        return;
+    queueWrite(buffer, lane, key, std::move(completion));
+    leaveGate();
+    // Outside of the gate, finishing the call waits for everyone inside.
+    if (mIsCancelRequested.exchange(false, std::memory_order_acq_rel))
+        Cancel();
+}
+
+void Stream::queueWrite(const grpc::ByteBuffer &buffer, MessageLane lane, CoalescingKey key,
+    std::shared_ptr<WriteCompletion> &&completion)
+{
+    if (mIsCancelled.load(std::memory_order_relaxed)) {
+        mDroppedMessages.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Copying a ByteBuffer only takes another reference to its slices.
+    PendingWrite write{
+        .buffer = buffer,
+        .lane = lane,
+        .completion = std::move(completion),
+        .queuedAt = std::chrono::steady_clock::now(),
+    };
+    uint32_t entry = mLimits.policy == SlowConsumerPolicy::Coalesce
+        ? mLatest.entry(key)
+        : CoalescingTable<64>::InvalidEntry;
+    const auto latest = entry != CoalescingTable<64>::InvalidEntry
+        ? mLatestWrites.acquire()
+        : LatestWrites::InvalidHandle;
+    if (latest != LatestWrites::InvalidHandle) {
+        // A pending write of the same key is replaced where it is queued,
+        // superseded writes never take ring capacity.
+        mLatestWrites[latest] = std::move(write);
+        const auto superseded = mCoalesced[entry].exchange(latest, std::memory_order_acq_rel);
+        if (superseded != LatestWrites::InvalidHandle) {
+            releaseLatest(superseded);
+            mDroppedMessages.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        // The moved-from write becomes the placeholder.
+        write.coalescingEntry = entry;
     } else {
-        mServerBuffer.emplace(std::move(response));
+        // Without a free slot the write is queued like any other.
+        entry = CoalescingTable<64>::InvalidEntry;
     }
+
+    if (mQueueDepth.load(std::memory_order_relaxed) >= mLimits.maxQueuedMessages && !makeRoom())
+        return;
+    if (!mServerBuffers[size_t(lane)].tryPush(std::move(write))) {
+        // Other producers filled the ring meanwhile.
+        if (entry != CoalescingTable<64>::InvalidEntry) {
+            const auto undone = mCoalesced[entry].exchange(LatestWrites::InvalidHandle,
+                std::memory_order_acq_rel);
+            if (undone != LatestWrites::InvalidHandle)
+                releaseLatest(undone);
+        }
+        mDroppedMessages.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    mQueueDepth.fetch_add(1, std::memory_order_relaxed);
+
+    if (!mIsWriting.exchange(true, std::memory_order_acq_rel))
+        writeNext();
+}
+
+void Stream::queueControl(grpc::ByteBuffer &&buffer)
+{
+    mControl.push(std::move(buffer));
+    if (!mIsWriting.exchange(true, std::memory_order_acq_rel))
+        writeNext();
+}
+
+bool Stream::makeRoom()
+{
+    if (mLimits.policy == SlowConsumerPolicy::Cancel) {
+        Log(WARNING, "cancel slow stream: {}, {} messages queued", (void *) this,
+            mQueueDepth.load(std::memory_order_relaxed));
+        mDroppedMessages.fetch_add(1, std::memory_order_relaxed);
+        if (!mIsCancelled.exchange(true, std::memory_order_relaxed))
+            mIsCancelRequested.store(true, std::memory_order_release);
+        return false;
+    }
+
+    // Evict the oldest message of the least important lane. The producer may
+    // pop as well, the consumer is stuck behind the write in flight anyway.
+    PendingWrite evicted;
+    for (auto ring = mServerBuffers.rbegin(); ring != mServerBuffers.rend(); ++ring) {
+        if (ring->pop(&evicted)) {
+            mQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+            // An empty placeholder made room without dropping anything.
+            if (resolve(&evicted))
+                mDroppedMessages.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+    return true;
+}
+
+bool Stream::popNext(PendingWrite *write, size_t first, size_t last)
+{
+    for (size_t lane = first; lane < last; ++lane) {
+        while (mServerBuffers[lane].pop(write)) {
+            mQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+            if (resolve(write))
+                return true;
+        }
+    }
+    return false;
+}
+
+bool Stream::resolve(PendingWrite *write)
+{
+    if (write->coalescingEntry == CoalescingTable<64>::InvalidEntry)
+        return true;
+    // A producer that lost the ring to others may have emptied the entry.
+    const auto latest = mCoalesced[write->coalescingEntry].exchange(LatestWrites::InvalidHandle,
+        std::memory_order_acq_rel);
+    if (latest == LatestWrites::InvalidHandle)
+        return false;
+    *write = std::move(mLatestWrites[latest]);
+    releaseLatest(latest);
+    return true;
+}
+
+void Stream::releaseLatest(LatestWrites::Handle handle)
+{
+    // Drops the buffer and completion before anyone else takes the slot.
+    mLatestWrites[handle] = {};
+    mLatestWrites.release(handle);
+}
+
+void Stream::writeNext()
+{
+    while (true) {
+        grpc::ByteBuffer control;
+        if (mControl.pop(&control)) {
+            mWriteBuffer = std::move(control);
+            mWriteQueuedAt = {};
+            StartWrite(&mWriteBuffer);
+            return;
+        }
+
+        // Messages of higher lanes pushed after the lookahead was taken still
+        // go out first, the lookahead stays held.
+        std::optional<PendingWrite> next;
+        PendingWrite write;
+        if (popNext(&write, 0, mLookahead ? size_t(mLookahead->lane) : MessageLaneCount))
+            next = std::move(write);
+        else
+            next = std::exchange(mLookahead, std::nullopt);
+        if (next) {
+            // Keep one message of the same lane back. If there is one the
+            // transport may hold this write and send both together.
+            const auto lane = size_t(next->lane);
+            if (!mLookahead && popNext(&write, lane, lane + 1))
+                mLookahead = std::move(write);
+            mWriteBuffer = std::move(next->buffer);
+            mWriteCompletion = std::move(next->completion);
+            mWriteQueuedAt = next->queuedAt;
+            grpc::WriteOptions options;
+            if (mLookahead)
+                options.set_buffer_hint();
+            StartWrite(&mWriteBuffer, options);
+            return;
+        }
+
+        // Nothing left, give up ownership. Re-check afterwards as the producer
+        // may have pushed after the last pop but before the flag was cleared.
+        mWriteBuffer.Clear();
+        mIsWriting.store(false, std::memory_order_seq_cst);
+        bool pending = !mControl.isEmpty();
+        for (const auto &ring : mServerBuffers)
+            pending |= !ring.isEmpty();
+        if (!pending || mIsWriting.exchange(true, std::memory_order_acq_rel))
+            return;
+    }
+}
+
+StreamStats Stream::stats() const noexcept
+{
+    return {
+        .queueDepth = queueDepth(),
+        .droppedMessages = droppedMessages(),
+        .writtenMessages = mWrittenMessages.value(),
+        .writeLatency = mWriteLatency.snapshot(),
+    };
 }
 
 void Stream::Cancel() const
 {
+    if (!enterGate())
+        return;
+    // OnCancel and OnDone may run inline, their closeGate() must not wait for
+    // this thread.
+    const auto *previous = std::exchange(tCancelling, this);
     mContext->TryCancel();
+    tCancelling = previous;
+    leaveGate();
+}
+
+bool Stream::enterGate() const noexcept
+{
+    if ((mGate.fetch_add(1, std::memory_order_acquire) & GateClosed) == 0)
+        return true;
+    leaveGate();
+    return false;
+}
+
+void Stream::leaveGate() const noexcept
+{
+    mGate.fetch_sub(1, std::memory_order_release);
+}
+
+void Stream::closeGate() noexcept
+{
+    mGate.fetch_or(GateClosed, std::memory_order_acq_rel);
+    // Only a write or cancel in progress, never a whole broadcast.
+    const uint32_t own = tCancelling == this ? 1 : 0;
+    while ((mGate.load(std::memory_order_acquire) & ~GateClosed) != own)
+        std::this_thread::yield();
+}
+
+void Stream::detach()
+{
+    closeGate();
+    // Release pending completions now, not whenever the epoch frees this.
+    for (auto &ring : mServerBuffers) {
+        PendingWrite write;
+        while (ring.pop(&write))
+            mQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+    }
+    for (auto &latest : mCoalesced) {
+        const auto handle = latest.exchange(LatestWrites::InvalidHandle, std::memory_order_acq_rel);
+        if (handle != LatestWrites::InvalidHandle)
+            releaseLatest(handle);
+    }
+    mLookahead.reset();
+    mWriteCompletion.reset();
+}
+
+void Stream::finish(grpc::Status status)
+{
+    // Cancellation and failed reads or writes may race to end the call.
+    if (!mIsFinished.exchange(true, std::memory_order_acq_rel)) {
+        // A write started after Finish could outlive the call.
+        closeGate();
+        Finish(std::move(status));
+    }
+}
+
+void Stream::link(uint32_t tag, std::shared_ptr<StreamHandler> &&handler)
+{
+    auto *route = new StreamRoute{ .stream = this, .handler = std::move(handler), .tag = tag };
+    mRoutes.emplace(tag, route);
+    route->handler->connect(route);
+}
+
+void Stream::unlink(StreamRoute *route)
+{
+    // The handler may go with its last stream, outside of disconnect.
+    const auto handler = std::move(route->handler);
+    if (!handler->disconnect(route))
+        Log(ERROR, "Failed to disconnect: {}", (void *) this);
+    Epoch::retire(route);
 }
 
 void Stream::OnDone()
 {
     Log(INFO, "stream done: {}", (void *) this);
-    if (mHandler) { // in case of early Finish
-        if (!mHandler->disconnect(this))
-            Log(ERROR, "Failed to disconnect: {}", (void *) this);
-    } else {
-        delete this;
-    }
+    // Broadcasts that loaded a route before it was unlinked may still write
+    // to this stream. The pin keeps it alive until return.
+    const auto guard = Epoch::pin();
+    for (const auto &[tag, route] : mRoutes)
+        unlink(route);
+    mRoutes.clear();
+    detach();
+    Epoch::retire(this);
 }
 
 void Stream::OnCancel()
 {
-    Finish(grpc::Status::CANCELLED);
+    finish(grpc::Status::CANCELLED);
 }
 
 void Stream::OnReadDone(bool ok)
@@ -57,32 +360,151 @@ void Stream::OnReadDone(bool ok)
     if (!ok) {
         if (mContext->IsCancelled())
             return;
-        Finish(grpc::Status::OK);
+        finish(grpc::Status::OK);
+        return;
+    }
+    if (isMultiplexed()) {
+        if (!readMultiplexed())
+            return;
+        StartRead(&mReadBuffer);
+        return;
+    }
+    const auto status = grpc::SerializationTraits<api::ClientMessage>::Deserialize(&mReadBuffer,
+        &mClientMessage);
+    if (!status.ok()) {
+        Log(ERROR, "Failed to parse client message: {}", status.error_message());
+        finish(status);
+        return;
+    }
+    handleClientMessage(*mRoutes.at(0));
+    StartRead(&mReadBuffer);
+}
+
+bool Stream::readMultiplexed()
+{
+    api::MultiplexClientMessage message;
+    const auto status = grpc::SerializationTraits<api::MultiplexClientMessage>::Deserialize(
+        &mReadBuffer, &message);
+    if (!status.ok()) {
+        Log(ERROR, "Failed to parse multiplexed message: {}", status.error_message());
+        finish(status);
+        return false;
+    }
+
+    const uint32_t tag = message.tag();
+    const auto it = mRoutes.find(tag);
+    switch (message.data_case()) {
+    case api::MultiplexClientMessage::kSubscribe:
+        replyStatus(tag, subscribePlugin(tag, message.subscribe()));
+        break;
+    case api::MultiplexClientMessage::kUnsubscribe:
+        if (it == mRoutes.end()) {
+            replyStatus(tag, "tag not subscribed");
+            break;
+        }
+        unlink(it->second);
+        mRoutes.erase(it);
+        replyStatus(tag, {});
+        break;
+    case api::MultiplexClientMessage::kMessage:
+        if (it == mRoutes.end()) {
+            replyStatus(tag, "tag not subscribed");
+            break;
+        }
+        mClientMessage = std::move(*message.mutable_message());
+        handleClientMessage(*it->second);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+std::string_view Stream::subscribePlugin(uint32_t tag, uint64_t pluginId)
+{
+    if (tag == 0)
+        return "tag must not be 0";
+    if (mRoutes.contains(tag))
+        return "tag already subscribed";
+    auto handler = mHandlers->find(pluginId);
+    if (!handler)
+        return "plugin_id not found";
+    link(tag, std::move(handler));
+    return {};
+}
+
+void Stream::replyStatus(uint32_t tag, std::string_view error)
+{
+    api::MultiplexServerMessage reply;
+    reply.set_tag(tag);
+    reply.mutable_status()->set_error(std::string(error));
+    queueControl(WireBufferPool::instance().serialize(reply));
+}
+
+void Stream::handleClientMessage(StreamRoute &route)
+{
+    if (mClientMessage.has_transport()) {
+        handleTransport(route, mClientMessage.transport());
+        return;
+    }
+    if (mClientMessage.has_event() && mClientMessage.event().has_request()) {
+        updateSubscription(route, mClientMessage.event());
         return;
     }
-    if (!mHandler->mOnReadCallback(*this))
-        mHandler->mClientQueue.push(std::move(mClientMessage));
-    StartRead(&mClientMessage);
+    if (!route.handler->mOnReadCallback(*this))
+        route.handler->pushClientMessage(std::move(mClientMessage));
+}
+
+void Stream::handleTransport(StreamRoute &route, const api::transport::Client &request)
+{
+    switch (request.request()) {
+    case api::transport::Client::SHARED_MEMORY_ENABLE: {
+        api::ServerMessage reply;
+        if (route.tag != 0) {
+            // The ring position is tracked per stream, not per route.
+            reply.mutable_transport()->set_error("shared memory is not available when multiplexed");
+            queueControl(tagMessage(route.tag, WireBufferPool::instance().serialize(reply)));
+            break;
+        }
+        route.handler->enableSharedMemory(this, request.socket(), reply.mutable_transport());
+        queueControl(WireBufferPool::instance().serialize(reply));
+        break;
+    }
+    case api::transport::Client::SHARED_MEMORY_DISABLE:
+        if (route.tag == 0)
+            route.handler->disableSharedMemory(this);
+        break;
+    default:
+        break;
+    }
+}
+
+void Stream::updateSubscription(StreamRoute &route, const api::event::Client &request)
+{
+    // Broadcasts may still filter with the previous subscription.
+    const auto *current = route.subscription.load(std::memory_order_relaxed);
+    route.subscription.store(Subscription::apply(current, request).release(),
+        std::memory_order_release);
+    if (current)
+        Epoch::retire(current);
 }
 
 void Stream::OnWriteDone(bool ok)
 {
+    if (auto completion = std::exchange(mWriteCompletion, nullptr); completion && ok)
+        completion->markWritten();
     if (!ok) {
         if (mContext->IsCancelled())
             return;
-        Finish(grpc::Status::OK);
+        finish(grpc::Status::OK);
         return;
     }
-
-    if (!mServerBuffer.empty()) {
-        mServerMessage = std::move(mServerBuffer.front());
-        mServerBuffer.pop();
-        StartWrite(mServerMessage.get());
-        return;
+    if (mWriteQueuedAt != std::chrono::steady_clock::time_point{}) {
+        mWrittenMessages.add();
+        mWriteLatency.record(std::chrono::steady_clock::now() - mWriteQueuedAt);
     }
 
-    mServerMessage.reset();
-    mIsWriting = false;
+    writeNext();
 }
 
 CLAP_RPC_END_NAMESPACE
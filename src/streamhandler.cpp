@@ -1,57 +1,398 @@
 // SPDX-License-Identifier: MIT
 // Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
 
+#include "doorbell.h"
+#include "epoch.h"
 #include "logging.h"
+#include "sharedmemory.h"
+#include "subscription.h"
+#include "wirebuffer.h"
 
 #include <clap-rpc/server.hpp>
 #include <clap-rpc/stream.hpp>
 #include <clap-rpc/streamhandler.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <thread>
+#include <cerrno>
+#include <cstring>
+#include <utility>
 
 CLAP_RPC_BEGIN_NAMESPACE
 
-StreamHandler::StreamHandler(Server *server)
-    : mOnReadCallback([](const Stream &) { return false; }), mServer(server)
+StreamHandler::StreamHandler(Server *server, size_t messagePoolSize)
+    : mClientDoorbell(std::make_unique<Doorbell>())
+    , mServerPool(messagePoolSize)
+    , mOnReadCallback([](const Stream &) { return false; })
+    , mServer(server)
 {
+    // Lets an exhausted pool hand out a slot while a sacrificed one waits
+    // for the worker.
+    if (mServerPool.size() > 1)
+        mServerPool.keepReserve(mServerPool.acquire());
 }
 
 StreamHandler::~StreamHandler()
 {
-    // On successfull shutdown with a single stream left the deleter for the
-    // StreamHandler may interfere with a prior disconnect call as it would
-    // release the last shared_ptr instance of this but still hold the
-    // mStreamMtx.
-    std::shared_lock<std::shared_mutex> lock(mSharedStreamsMtx, std::defer_lock);
-    if (lock.try_lock())
-        cancelAll();
+    cancelAll();
+    // Nobody reads the snapshot anymore.
+    delete mStreams.load(std::memory_order_acquire);
+    closeDoorbellFd(mClientMessageFd.load(std::memory_order_relaxed));
 }
 
-void StreamHandler::pushMessage(api::ServerMessage &&response)
+PooledMessage StreamHandler::acquireMessage()
 {
-    mServerQueue.push(std::move(response));
-    mServer->tryNotify();
+    auto handle = mServerPool.acquire();
+    if (handle == ServerMessagePool::InvalidHandle) {
+        // Like a full queue, sacrifice the oldest pending message, starting
+        // with the least important lane, and hand its slot to the new one.
+        auto sacrificed = ServerMessagePool::InvalidHandle;
+        ServerMessagePool::Handle entry = ServerMessagePool::InvalidHandle;
+        for (auto queue = mServerQueues.rbegin(); queue != mServerQueues.rend(); ++queue) {
+            while (sacrificed == ServerMessagePool::InvalidHandle && queue->pop(&entry))
+                sacrificed = resolve(entry);
+        }
+        if (sacrificed != ServerMessagePool::InvalidHandle) {
+            mMetrics.dropped.add();
+            if (mServerPool[sacrificed].isCompact()) {
+                mServerPool[sacrificed].discard();
+                handle = sacrificed;
+            } else {
+                // Freeing the extra blocks is for the worker, take the reserve.
+                mServerPool.retire(sacrificed);
+            }
+        }
+        if (handle == ServerMessagePool::InvalidHandle)
+            handle = mServerPool.acquireReserve();
+        mServer->tryNotify(this);
+        if (handle == ServerMessagePool::InvalidHandle) {
+            // Only if the reserve is out as well, the new message is lost.
+            mMetrics.dropped.add();
+            return {};
+        }
+    }
+    return PooledMessage(&mServerPool, handle, mServerPool[handle].rearm());
 }
 
-void StreamHandler::pushMessage(const api::ServerMessage &response)
+void StreamHandler::pushMessage(PooledMessage &&response, CoalescingKey key, MessageLane lane)
 {
-    mServerQueue.push(response);
-    mServer->tryNotify();
+    if (!response)
+        return;
+    if (lane == MessageLane::Auto)
+        lane = laneFor(*response);
+    mMetrics.pushed.add();
+
+    auto queued = response.release();
+    if (const auto entry = mCoalescing.entry(key); entry != CoalescingSlots::InvalidEntry) {
+        const auto superseded = mCoalescing.exchange(entry, queued);
+        if (superseded != CoalescingSlots::InvalidHandle) {
+            // The entry is already queued and now refers to the new message.
+            mServerPool.retire(superseded);
+            mMetrics.coalesced.add();
+            mServer->tryNotify(this);
+            return;
+        }
+        queued = CoalescedTag | entry;
+    }
+
+    // Every queued entry owns a distinct pool slot, no ring can overflow.
+    [[maybe_unused]] const bool pushed = mServerQueues[size_t(lane)].tryPush(queued);
+    assert(pushed);
+    mServer->tryNotify(this);
+}
+
+void StreamHandler::pushMessage(api::ServerMessage &&response, CoalescingKey key,
+    MessageLane lane)
+{
+    if (auto message = acquireMessage()) {
+        *message = std::move(response); // copies into the arena
+        pushMessage(std::move(message), key, lane);
+    }
+}
+
+void StreamHandler::pushMessage(const api::ServerMessage &response, CoalescingKey key,
+    MessageLane lane)
+{
+    if (auto message = acquireMessage()) {
+        message->CopyFrom(response);
+        pushMessage(std::move(message), key, lane);
+    }
+}
+
+void StreamHandler::pushMessages(std::span<api::ServerMessage> responses, MessageLane lane)
+{
+    if (responses.empty())
+        return;
+    // Handles are collected per lane and flushed in batches.
+    struct Pending
+    {
+        std::array<ServerMessagePool::Handle, 32> handles;
+        size_t count = 0;
+    };
+    std::array<Pending, MessageLaneCount> pending{};
+    const auto flush = [this, &pending](size_t index) {
+        mServerQueues[index].tryPushN(pending[index].handles.begin(), pending[index].count);
+        pending[index].count = 0;
+    };
+
+    size_t queued = 0;
+    for (auto &response : responses) {
+        auto message = acquireMessage();
+        if (!message)
+            break;
+        const auto index = size_t(lane == MessageLane::Auto ? laneFor(response) : lane);
+        *message = std::move(response);
+        auto &batch = pending[index];
+        batch.handles[batch.count++] = message.release();
+        if (batch.count == batch.handles.size())
+            flush(index);
+        ++queued;
+    }
+    for (size_t index = 0; index < pending.size(); ++index) {
+        if (pending[index].count != 0)
+            flush(index);
+    }
+    mMetrics.pushed.add(queued);
+    // acquireMessage already counted the first message that found no slot.
+    if (queued + 1 < responses.size())
+        mMetrics.dropped.add(responses.size() - queued - 1);
+    mServer->tryNotify(this);
+}
+
+PooledMessage StreamHandler::openBatch(int64_t steadyTime, uint32_t framesCount)
+{
+    auto message = acquireMessage();
+    if (message) {
+        auto *batch = message->mutable_event()->mutable_batch();
+        batch->set_steady_time(steadyTime);
+        batch->set_frames_count(framesCount);
+    }
+    return message;
+}
+
+api::event::EventMessage *StreamHandler::appendEvent(PooledMessage &batch)
+{
+    if (!batch || !batch->event().has_batch())
+        return nullptr;
+    return batch->mutable_event()->mutable_batch()->add_events();
+}
+
+bool StreamHandler::commitBatch(PooledMessage &&batch)
+{
+    if (!batch || !batch->event().has_batch() || batch->event().batch().events().empty()) {
+        batch.reset();
+        return false;
+    }
+    pushMessage(std::move(batch));
+    return true;
+}
+
+ServerMessagePool::Handle StreamHandler::resolve(ServerMessagePool::Handle entry)
+{
+    if ((entry & CoalescedTag) == 0)
+        return entry;
+    return mCoalescing.take(entry & ~CoalescedTag);
+}
+
+void StreamHandler::dispatch(ServerMessagePool::Handle entry, MessageLane lane)
+{
+    const auto handle = resolve(entry);
+    if (handle == ServerMessagePool::InvalidHandle)
+        return;
+    mMetrics.dispatched.add();
+    const auto key = (entry & CoalescedTag) != 0 ? mCoalescing.key(entry & ~CoalescedTag)
+                                                 : CoalescingKey{};
+
+    // Serialize straight out of the arena, the slot is free again right after.
+    auto &slot = mServerPool[handle];
+    broadcast(*slot.message(), lane, key);
+    slot.recycle();
+    mServerPool.release(handle);
+}
+
+void StreamHandler::broadcast(api::ServerMessage &&message, MessageLane lane, CoalescingKey key)
+{
+    broadcast(std::as_const(message), lane, key);
+}
+
+void StreamHandler::broadcast(const api::ServerMessage &message, MessageLane lane,
+    CoalescingKey key)
+{
+    broadcast(message, lane, key, {});
+}
+
+void StreamHandler::broadcast(const api::ServerMessage &message, MessageLane lane,
+    CoalescingKey key, const std::shared_ptr<WriteCompletion> &completion)
+{
+    // Connects and disconnects never block this, they publish a new list.
+    const auto guard = Epoch::pin();
+    const auto *streams = mStreams.load(std::memory_order_acquire);
+    if (!streams || streams->empty())
+        return;
+    if (lane == MessageLane::Auto)
+        lane = laneFor(message);
+    const auto start = std::chrono::steady_clock::now();
+
+    // Streams that unsubscribed from some events are checked before anything
+    // is serialized for them.
+    const uint32_t kinds = eventKinds(message);
+    const auto acceptsAll = [&](const StreamRoute *route) {
+        const auto *subscription = route->subscription.load(std::memory_order_acquire);
+        if (!subscription)
+            return true;
+        if ((kinds & subscription->kinds) != kinds)
+            return false;
+        if (!subscription->isPartial(kinds))
+            return true;
+        return !message.event().has_batch() && subscription->accepts(message.event().event());
+    };
+
+    // Realtime messages for local clients go through the shared ring once.
+    // Every local reader sees the whole ring, so an event only goes there if
+    // all of them want it in full. Otherwise those that do get it over their
+    // stream.
+    uint64_t position = SharedMemoryRing::NotPublished;
+    bool hasSleepers = false;
+    if (lane == MessageLane::Realtime && mSharedMemoryStreams.load(std::memory_order_acquire)) {
+        const bool isWanted = kinds == 0 || std::ranges::all_of(*streams, [&](const auto *route) {
+            return route->tag != 0
+                || route->stream->mSharedMemoryStart.load(std::memory_order_acquire)
+                == Stream::SharedMemoryOff
+                || acceptsAll(route);
+        });
+        if (isWanted) {
+            std::scoped_lock shmLock(mSharedMemoryMtx);
+            position = mSharedMemory->publish(message);
+            hasSleepers = position != SharedMemoryRing::NotPublished
+                && mSharedMemory->hasSleepers();
+        }
+    }
+    grpc::ByteBuffer buffer;
+    const auto write = [&](const StreamRoute *route, const grpc::ByteBuffer &payload) {
+        if (route->tag == 0) {
+            route->stream->StartSharedWrite(payload, lane, key, completion);
+            return;
+        }
+        // Keys of different plugins would collide within a multiplexed stream.
+        route->stream->StartSharedWrite(tagMessage(route->tag, payload), lane, {}, completion);
+    };
+    for (const auto *route : *streams) {
+        const auto *stream = route->stream;
+        if (position != SharedMemoryRing::NotPublished
+            && position >= stream->mSharedMemoryStart.load(std::memory_order_acquire)) {
+            if (hasSleepers)
+                ringDoorbellFd(stream->mDoorbellFd);
+            if (completion)
+                completion->markWritten();
+            continue;
+        }
+        const auto *subscription =
+            kinds != 0 ? route->subscription.load(std::memory_order_acquire) : nullptr;
+        if (subscription && (kinds & subscription->kinds) == 0)
+            continue;
+        if (subscription && subscription->isPartial(kinds)) {
+            if (message.event().has_batch()) {
+                // Only this stream gets the remaining events.
+                api::ServerMessage filtered;
+                if (subscription->filter(message, &filtered))
+                    write(route, WireBufferPool::instance().serialize(filtered));
+                continue;
+            }
+            if (!subscription->accepts(message.event().event()))
+                continue;
+        }
+        if (!buffer.Valid())
+            buffer = WireBufferPool::instance().serialize(message);
+        write(route, buffer);
+    }
+    mMetrics.broadcastTime.record(std::chrono::steady_clock::now() - start);
 }
 
-void StreamHandler::broadcast(api::ServerMessage &&message)
+bool StreamHandler::queueSend(PendingSend &send)
 {
-    auto smessage = std::make_shared<api::ServerMessage>(std::move(message));
-    std::shared_lock<std::shared_mutex> lock(mSharedStreamsMtx);
-    for (const auto &stream : mStreams)
-        stream->StartSharedWrite(smessage);
+    // Leaves send untouched if the queue is full.
+    if (!mSends.tryPush(std::move(send)))
+        return false;
+    mServer->tryNotify(this);
+    return true;
+}
+
+void StreamHandler::dispatchSends()
+{
+    // Resumed coroutines may send again, those wait for the next round.
+    PendingSend send;
+    for (size_t count = mSends.size(); count != 0 && mSends.pop(&send); --count) {
+        broadcast(*send.message, send.lane, {}, send.completion);
+        send.completion.reset();
+    }
+}
+
+MessageLane StreamHandler::laneFor(const api::ServerMessage &message) noexcept
+{
+    switch (message.data_case()) {
+    case api::ServerMessage::kEvent: {
+        const auto &event = message.event();
+        if (event.has_event() && event.event().has_transport())
+            return MessageLane::State;
+        return MessageLane::Realtime;
+    }
+    case api::ServerMessage::kPlugin:
+    case api::ServerMessage::kGui:
+        return MessageLane::State;
+    default:
+        return MessageLane::Bulk;
+    }
+}
+
+size_t StreamHandler::numStreams() const noexcept
+{
+    const auto guard = Epoch::pin();
+    const auto *streams = mStreams.load(std::memory_order_acquire);
+    return streams ? streams->size() : 0;
 }
 
 void StreamHandler::cancelAll() const
 {
-    std::shared_lock<std::shared_mutex> lock(mSharedStreamsMtx);
-    for (const auto &s : mStreams)
-        s->Cancel();
+    const auto guard = Epoch::pin();
+    if (const auto *streams = mStreams.load(std::memory_order_acquire)) {
+        for (const auto *route : *streams) {
+            if (route->tag == 0)
+                route->stream->Cancel();
+        }
+    }
+}
+
+std::vector<StreamStats> StreamHandler::streamStats() const
+{
+    std::vector<StreamStats> stats;
+    const auto guard = Epoch::pin();
+    if (const auto *streams = mStreams.load(std::memory_order_acquire)) {
+        stats.reserve(streams->size());
+        for (const auto *route : *streams)
+            stats.push_back(route->stream->stats());
+    }
+    return stats;
+}
+
+HandlerStats StreamHandler::stats() const
+{
+    HandlerStats stats;
+    stats.id = mId;
+    stats.worker = mShard;
+    for (const auto &queue : mServerQueues)
+        stats.pendingMessages += queue.size();
+    stats.pendingClientMessages = mClientQueue.size();
+    stats.pushedMessages = mMetrics.pushed.value();
+    stats.coalescedMessages = mMetrics.coalesced.value();
+    stats.droppedMessages = mMetrics.dropped.value();
+    stats.dispatchedMessages = mMetrics.dispatched.value();
+    stats.clientMessages = mMetrics.clientMessages.value();
+    stats.droppedClientMessages = mClientQueue.discarded();
+    stats.broadcastTime = mMetrics.broadcastTime.snapshot();
+    stats.streams = streamStats();
+    return stats;
 }
 
 void StreamHandler::setInterceptor(std::function<bool(const Stream &)> &&callback)
@@ -64,31 +405,232 @@ bool StreamHandler::tryPop(api::ClientMessage *message)
     return mClientQueue.pop(message);
 }
 
+size_t StreamHandler::tryPop(std::span<api::ClientMessage> messages)
+{
+    return mClientQueue.popN(messages.begin(), messages.size());
+}
+
 api::ClientMessage StreamHandler::pop()
 {
-    // TODO: exponential backoff?
     api::ClientMessage message;
-    while (!tryPop(&message))
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    popUntil(&message, std::chrono::steady_clock::time_point::max());
     return message;
 }
 
-void StreamHandler::connect(std::unique_ptr<Stream> &&client)
+bool StreamHandler::popFor(api::ClientMessage *message, std::chrono::nanoseconds timeout)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto remaining = std::chrono::steady_clock::time_point::max() - now;
+    return popUntil(message, timeout < remaining ? now + timeout
+                                                 : std::chrono::steady_clock::time_point::max());
+}
+
+bool StreamHandler::popUntil(api::ClientMessage *message,
+    std::chrono::steady_clock::time_point deadline)
+{
+    return mClientDoorbell->waitUntil(deadline, [&] { return tryPop(message); });
+}
+
+int StreamHandler::clientMessageFd()
+{
+    int fd = mClientMessageFd.load(std::memory_order_acquire);
+    if (fd >= 0)
+        return fd;
+    const int created = createDoorbellFd();
+    if (created < 0)
+        return -1;
+    if (!mClientMessageFd.compare_exchange_strong(fd, created, std::memory_order_acq_rel)) {
+        closeDoorbellFd(created);
+        return fd;
+    }
+    // Messages that arrived before the fd existed are still pending.
+    if (!mClientQueue.isEmpty())
+        ringDoorbellFd(created);
+    return created;
+}
+
+void StreamHandler::pushClientMessage(api::ClientMessage &&message)
+{
+    mMetrics.clientMessages.add();
+    if (!mClientQueue.push(std::move(message))) {
+        Log(WARNING, "client queue full, message dropped: {}", mId);
+        return;
+    }
+    if (const int fd = mClientMessageFd.load(std::memory_order_acquire); fd >= 0)
+        ringDoorbellFd(fd);
+    mClientDoorbell->ring();
+    // Pairs with the increment in addClientWaiter, either the waiter sees
+    // the message or this sees the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mNumClientWaiters.load(std::memory_order_relaxed) != 0)
+        resumeClientWaiters();
+}
+
+bool StreamHandler::addClientWaiter(std::coroutine_handle<> handle, Executor *executor,
+    api::ClientMessage *message)
+{
+    std::scoped_lock lock(mClientWaitersMtx);
+    mClientWaiters.push_back({ handle, executor, message });
+    mNumClientWaiters.fetch_add(1, std::memory_order_seq_cst);
+    // A message queued before the increment went unnoticed by the reader.
+    // Behind other waiters the reader resumes them in order anyway.
+    if (mClientWaiters.size() != 1 || !tryPop(message))
+        return true;
+    mClientWaiters.pop_back();
+    mNumClientWaiters.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+void StreamHandler::resumeClientWaiters()
+{
+    while (true) {
+        ClientWaiter waiter;
+        {
+            std::scoped_lock lock(mClientWaitersMtx);
+            if (mClientWaiters.empty() || !tryPop(mClientWaiters.front().message))
+                return;
+            waiter = mClientWaiters.front();
+            mClientWaiters.pop_front();
+            mNumClientWaiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        // Outside the lock, the coroutine may wait again right away.
+        waiter.executor->post(waiter.handle);
+    }
+}
+
+ClientMessageAwaiter StreamHandler::nextClientMessage(Executor &executor)
+{
+    return { this, &executor };
+}
+
+SendAwaiter StreamHandler::send(api::ServerMessage message, Executor &executor, MessageLane lane)
+{
+    return { this, &executor, std::move(message), lane };
+}
+
+bool ClientMessageAwaiter::await_ready()
+{
+    return mHandler->tryPop(&mMessage);
+}
+
+bool ClientMessageAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    return mHandler->addClientWaiter(handle, mExecutor, &mMessage);
+}
+
+bool SendAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    // Nothing would keep the completion alive. Continuing right away keeps a
+    // send loop from resuming itself within this call over and over.
+    if (mHandler->numStreams() == 0)
+        return false;
+
+    // The worker broadcasts it, the rings of a stream are only fed from
+    // broadcasting threads. Resumes once the last stream released it.
+    StreamHandler::PendingSend send{
+        .message = &mMessage,
+        .lane = mLane,
+        .completion = std::make_shared<WriteCompletion>(handle, mExecutor, &mWritten),
+    };
+    if (!mHandler->queueSend(send)) {
+        // The caller holds the last reference, the result is 0.
+        send.completion->dismiss();
+        return false;
+    }
+    return true;
+}
+
+void StreamHandler::connect(StreamRoute *route)
 {
-    std::unique_lock<std::shared_mutex> lock(mSharedStreamsMtx);
-    Log(INFO, "connected: {}", (void *) client.get());
-    mStreams.emplace(std::move(client));
+    Log(INFO, "connected: {}", (void *) route->stream);
+    const std::vector<StreamRoute *> *current = nullptr;
+    {
+        std::scoped_lock lock(mStreamsMtx);
+        current = mStreams.load(std::memory_order_relaxed);
+        auto *next = current ? new std::vector<StreamRoute *>(*current)
+                             : new std::vector<StreamRoute *>;
+        route->index = next->size();
+        next->push_back(route);
+        mStreams.store(next, std::memory_order_release);
+    }
+    if (current)
+        Epoch::retire(current);
 }
 
-bool StreamHandler::disconnect(Stream *client)
+bool StreamHandler::enableSharedMemory(Stream *stream, const std::string &socket,
+    api::transport::Server *reply)
 {
-    std::unique_lock guard(mSharedStreamsMtx);
-    const auto it = std::ranges::find_if(mStreams,
-        [client](const auto &p) { return p.get() == client; });
-    if (it == mStreams.end())
+    std::scoped_lock lock(mSharedMemoryMtx);
+    if (mSharedMemorySize == 0) {
+        reply->set_error("shared memory is disabled");
+        return false;
+    }
+    if (socket.empty()) {
+        reply->set_error("shared memory needs a socket to pass the descriptors");
         return false;
-    mStreams.erase(it);
-    Log(INFO, "disconnected: {}", (void *) client);
+    }
+    if (!mSharedMemory)
+        mSharedMemory = SharedMemoryRing::create(mSharedMemorySize);
+    if (!mSharedMemory) {
+        reply->set_error(std::string("shared memory is not available: ") + std::strerror(errno));
+        return false;
+    }
+    if (stream->mDoorbellFd < 0)
+        stream->mDoorbellFd = createDoorbellFd();
+
+    // The descriptors are waiting for the client by the time it reads the
+    // reply.
+    const shm::Descriptors fds = { mSharedMemory->memoryFd(), mSharedMemory->sleepersFd(),
+        stream->mDoorbellFd };
+    if (const int error = sendDescriptors(socket, fds); error != 0) {
+        reply->set_error(std::string("passing the descriptors failed: ") + std::strerror(error));
+        return false;
+    }
+
+    // Everything published from now on is read from the ring by this stream.
+    const uint64_t start = mSharedMemory->head();
+    if (stream->mSharedMemoryStart.exchange(start, std::memory_order_acq_rel)
+        == Stream::SharedMemoryOff)
+        mSharedMemoryStreams.fetch_add(1, std::memory_order_release);
+
+    auto *info = reply->mutable_shared_memory();
+    info->set_version(shm::RingVersion);
+    info->set_size(mSharedMemory->mappedSize());
+    info->set_start(start);
+    Log(INFO, "shared memory enabled: {}", (void *) stream);
+    return true;
+}
+
+void StreamHandler::disableSharedMemory(Stream *stream)
+{
+    std::scoped_lock lock(mSharedMemoryMtx);
+    if (stream->mSharedMemoryStart.exchange(Stream::SharedMemoryOff, std::memory_order_acq_rel)
+        != Stream::SharedMemoryOff)
+        mSharedMemoryStreams.fetch_sub(1, std::memory_order_release);
+}
+
+bool StreamHandler::disconnect(StreamRoute *route)
+{
+    if (route->tag == 0)
+        disableSharedMemory(route->stream);
+    const std::vector<StreamRoute *> *current = nullptr;
+    {
+        std::scoped_lock lock(mStreamsMtx);
+        current = mStreams.load(std::memory_order_relaxed);
+        const size_t index = route->index;
+        if (!current || index >= current->size() || (*current)[index] != route)
+            return false;
+        // The route knows its position, the last one takes its place.
+        auto *next = new std::vector<StreamRoute *>(*current);
+        (*next)[index] = next->back();
+        (*next)[index]->index = index;
+        next->pop_back();
+        mStreams.store(next, std::memory_order_release);
+    }
+    // Broadcasts pinned before the swap may still use the route, the stream
+    // retires it once unlinked.
+    Epoch::retire(current);
+    Log(INFO, "disconnected: {}", (void *) route->stream);
     return true;
 }
 
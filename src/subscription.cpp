@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "subscription.h"
+
+#include <algorithm>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+namespace {
+
+uint32_t eventKind(const api::event::EventMessage &event) noexcept
+{
+    switch (event.data_case()) {
+    case api::event::EventMessage::kNote:
+    case api::event::EventMessage::kNoteExpression:
+        return NoteEvents;
+    case api::event::EventMessage::kParam:
+    case api::event::EventMessage::kParamGesture:
+        return ParamEvents;
+    case api::event::EventMessage::kMidi:
+        return MidiEvents;
+    case api::event::EventMessage::kTransport:
+        return TransportEvents;
+    default:
+        return 0;
+    }
+}
+
+} // namespace
+
+uint32_t eventKinds(const api::ServerMessage &message) noexcept
+{
+    if (!message.has_event())
+        return 0;
+    const auto &event = message.event();
+    switch (event.data_case()) {
+    case api::event::Server::kEvent:
+        return eventKind(event.event());
+    case api::event::Server::kBatch: {
+        uint32_t kinds = 0;
+        for (const auto &e : event.batch().events())
+            kinds |= eventKind(e);
+        return kinds;
+    }
+    case api::event::Server::kNative:
+        return NativeEvents;
+    default:
+        return 0;
+    }
+}
+
+bool Subscription::isPartial(uint32_t messageKinds) const noexcept
+{
+    if ((messageKinds & ~kinds) != 0)
+        return true;
+    return (messageKinds & ParamEvents) != 0 && (isAllowList || !paramIds.empty());
+}
+
+bool Subscription::accepts(const api::event::EventMessage &event) const noexcept
+{
+    const uint32_t kind = eventKind(event);
+    if (kind == 0)
+        return true;
+    if ((kinds & kind) == 0)
+        return false;
+    if (kind != ParamEvents)
+        return true;
+    const uint32_t id = event.has_param() ? event.param().param_id()
+                                          : event.param_gesture().param_id();
+    return std::ranges::binary_search(paramIds, id) == isAllowList;
+}
+
+bool Subscription::filter(const api::ServerMessage &message, api::ServerMessage *filtered) const
+{
+    const auto &source = message.event().batch();
+    auto *batch = filtered->mutable_event()->mutable_batch();
+    batch->set_steady_time(source.steady_time());
+    batch->set_frames_count(source.frames_count());
+    for (const auto &e : source.events()) {
+        if (accepts(e))
+            batch->add_events()->CopyFrom(e);
+    }
+    return !batch->events().empty();
+}
+
+std::unique_ptr<Subscription> Subscription::apply(const Subscription *current,
+    const api::event::Client &request)
+{
+    auto next = current ? std::make_unique<Subscription>(*current)
+                        : std::make_unique<Subscription>();
+    const auto subscribe = [&next](uint32_t kind, bool enable) {
+        next->kinds = enable ? next->kinds | kind : next->kinds & ~kind;
+    };
+
+    using Request = api::event::Client;
+    switch (request.request()) {
+    case Request::NOTE_ENABLE:
+    case Request::NOTE_DISABLE:
+        subscribe(NoteEvents, request.request() == Request::NOTE_ENABLE);
+        break;
+    case Request::MIDI_ENABLE:
+    case Request::MIDI_DISABLE:
+        subscribe(MidiEvents, request.request() == Request::MIDI_ENABLE);
+        break;
+    case Request::TRANSPORT_ENABLE:
+    case Request::TRANSPORT_DISABLE:
+        subscribe(TransportEvents, request.request() == Request::TRANSPORT_ENABLE);
+        break;
+    case Request::NATIVE_ENABLE:
+    case Request::NATIVE_DISABLE:
+        subscribe(NativeEvents, request.request() == Request::NATIVE_ENABLE);
+        break;
+    case Request::PARAM_ENABLE:
+    case Request::PARAM_DISABLE: {
+        const bool enable = request.request() == Request::PARAM_ENABLE;
+        auto &ids = next->paramIds;
+        if (request.param_ids().empty()) {
+            next->isAllowList = !enable;
+            ids.clear();
+        }
+        for (const uint32_t id : request.param_ids()) {
+            const auto it = std::ranges::lower_bound(ids, id);
+            const bool isListed = it != ids.end() && *it == id;
+            // Enabling adds to an allow list and removes from a deny list.
+            if (enable == next->isAllowList && !isListed)
+                ids.insert(it, id);
+            else if (enable != next->isAllowList && isListed)
+                ids.erase(it);
+        }
+        subscribe(ParamEvents, !next->isAllowList || !ids.empty());
+        break;
+    }
+    default:
+        break;
+    }
+
+    if (next->kinds == AllEvents && !next->isAllowList && next->paramIds.empty())
+        return nullptr;
+    return next;
+}
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/api/clapservice.pb.h>
+#include <clap-rpc/global.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// The kinds of events a stream can subscribe to with the requests of
+// api::event::Client. Messages other than events are always delivered.
+enum EventKind : uint32_t {
+    NoteEvents = 1u << 0,
+    ParamEvents = 1u << 1,
+    MidiEvents = 1u << 2,
+    TransportEvents = 1u << 3,
+    NativeEvents = 1u << 4,
+    AllEvents = (1u << 5) - 1,
+};
+
+// The kinds of events in the message, 0 if it isn't an event message.
+[[nodiscard]] uint32_t eventKinds(const api::ServerMessage &message) noexcept;
+
+// What a stream receives of the event messages. Immutable once published,
+// the stream replaces it on every request and retires the previous one
+// through the Epoch. A stream without one receives everything.
+struct Subscription
+{
+    uint32_t kinds = AllEvents;
+    // Parameters are limited to the listed IDs, or to all but them.
+    bool isAllowList = false;
+    std::vector<uint32_t> paramIds; // sorted
+
+    // Whether only some of the events of these kinds pass.
+    [[nodiscard]] bool isPartial(uint32_t messageKinds) const noexcept;
+    [[nodiscard]] bool accepts(const api::event::EventMessage &event) const noexcept;
+    // Copies an event batch without the events that don't pass. Returns
+    // false if nothing is left to send.
+    bool filter(const api::ServerMessage &message, api::ServerMessage *filtered) const;
+
+    // The subscription after the request, empty once everything is
+    // subscribed again.
+    [[nodiscard]] static std::unique_ptr<Subscription> apply(const Subscription *current,
+        const api::event::Client &request);
+};
+
+CLAP_RPC_END_NAMESPACE
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "wirebuffer.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <grpc/slice.h>
+#include <grpcpp/support/slice.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+WireBufferPool &WireBufferPool::instance()
+{
+    // Intentionally never destroyed, gRPC may release slices during shutdown.
+    static auto *pool = new WireBufferPool();
+    return *pool;
+}
+
+WireBufferPool::~WireBufferPool()
+{
+    for (auto &freeList : mFree) {
+        Chunk *chunk = nullptr;
+        while (freeList.pop(&chunk))
+            ::operator delete(chunk);
+    }
+}
+
+grpc::ByteBuffer WireBufferPool::serialize(const google::protobuf::MessageLite &message)
+{
+    const size_t size = message.ByteSizeLong();
+    const auto sizeClass = static_cast<size_t>(
+        std::ranges::lower_bound(ChunkSizes, size) - ChunkSizes.begin());
+
+    if (sizeClass == ChunkSizes.size()) { // too large for the pool
+        grpc::Slice slice(grpc_slice_malloc(size), grpc::Slice::STEAL_REF);
+        message.SerializeWithCachedSizesToArray(
+            const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(slice.begin())));
+        return grpc::ByteBuffer(&slice, 1);
+    }
+
+    Chunk *chunk = acquire(sizeClass);
+    message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(chunk->data()));
+    grpc::Slice slice(chunk->data(), size, &WireBufferPool::release, chunk);
+    return grpc::ByteBuffer(&slice, 1);
+}
+
+WireBufferPool::Chunk *WireBufferPool::acquire(size_t sizeClass)
+{
+    Chunk *chunk = nullptr;
+    if (mFree[sizeClass].pop(&chunk))
+        return chunk;
+    void *memory = ::operator new(sizeof(Chunk) + ChunkSizes[sizeClass]);
+    return new (memory) Chunk{ this, sizeClass };
+}
+
+void WireBufferPool::release(void *ptr)
+{
+    auto *chunk = static_cast<Chunk *>(ptr);
+    if (!chunk->pool->mFree[chunk->sizeClass].tryPush(chunk))
+        ::operator delete(chunk);
+}
+
+grpc::ByteBuffer tagMessage(uint32_t tag, const grpc::ByteBuffer &message)
+{
+    using google::protobuf::io::CodedOutputStream;
+    // Field 1 is the varint tag, field 2 the length delimited message. Short
+    // enough for an inlined slice.
+    std::array<uint8_t, 12> header; // two keys and two varints of at most 5 bytes
+    uint8_t *pos = header.data();
+    *pos++ = 0x08;
+    pos = CodedOutputStream::WriteVarint32ToArray(tag, pos);
+    *pos++ = 0x12;
+    pos = CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(message.Length()), pos);
+
+    thread_local std::vector<grpc::Slice> slices;
+    (void) message.Dump(&slices);
+    slices.emplace(slices.begin(), header.data(), static_cast<size_t>(pos - header.data()));
+    grpc::ByteBuffer tagged(slices.data(), slices.size());
+    slices.clear();
+    return tagged;
+}
+
+CLAP_RPC_END_NAMESPACE
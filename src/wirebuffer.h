@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#pragma once
+
+#include <clap-rpc/global.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+
+#include <google/protobuf/message_lite.h>
+#include <grpcpp/support/byte_buffer.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+CLAP_RPC_BEGIN_NAMESPACE
+
+// Recycles the memory backing serialized messages. A message is serialized
+// once into a pooled chunk which is wrapped in a reference counted slice.
+// Every stream gets a ByteBuffer referencing that slice, and the chunk
+// returns to the pool once the last of them is released, i.e. after the
+// last stream finished writing it.
+class WireBufferPool
+{
+public:
+    static WireBufferPool &instance();
+
+    WireBufferPool(const WireBufferPool &) = delete;
+    WireBufferPool &operator=(const WireBufferPool &) = delete;
+
+    [[nodiscard]] grpc::ByteBuffer serialize(const google::protobuf::MessageLite &message);
+
+private:
+    static constexpr std::array<size_t, 3> ChunkSizes = { 256, 1024, 4096 };
+    static constexpr size_t MaxCachedChunks = 256;
+
+    struct Chunk
+    {
+        WireBufferPool *pool;
+        size_t sizeClass;
+
+        std::byte *data() noexcept
+        {
+            return reinterpret_cast<std::byte *>(this + 1);
+        }
+    };
+    using FreeList = MpMcQueue<Chunk *, MaxCachedChunks, QueueLayout::Interleaved>;
+
+    WireBufferPool() = default;
+    ~WireBufferPool();
+
+    Chunk *acquire(size_t sizeClass);
+    static void release(void *chunk);
+
+    std::array<FreeList, ChunkSizes.size()> mFree;
+};
+
+// Turns a serialized ServerMessage into a MultiplexServerMessage carrying
+// it under tag. Only a small header is prepended, the message slices are
+// shared with every other stream writing them.
+[[nodiscard]] grpc::ByteBuffer tagMessage(uint32_t tag, const grpc::ByteBuffer &message);
+
+CLAP_RPC_END_NAMESPACE
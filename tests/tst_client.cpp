@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include <catch2/catch_test_macros.hpp>
+#include <clap-rpc/client/client.hpp>
+#include <clap-rpc/server.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace clap::rpc;
+using namespace std::chrono_literals;
+
+namespace {
+template <typename Predicate>
+bool waitFor(Predicate &&predicate, std::chrono::milliseconds timeout = 5s)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+} // namespace
+
+TEST_CASE("MultiplePlugins", "[client]")
+{
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto first = server->createStreamHandler();
+    auto second = server->createStreamHandler();
+
+    Client client({ .uri = server->uri() });
+    REQUIRE(client.connect(first->id()));
+    REQUIRE(client.connect(second->id()));
+    REQUIRE_FALSE(client.connect(first->id()));
+    REQUIRE(waitFor(
+        [&] { return client.isConnected(first->id()) && client.isConnected(second->id()); }));
+
+    std::vector<std::pair<uint64_t, std::string>> hosts;
+    int events = 0;
+    client.on(api::ServerMessage::kHost, [&](uint64_t pluginId, const api::ServerMessage &message) {
+        hosts.emplace_back(pluginId, message.host().host().name());
+    });
+    client.on(api::ServerMessage::kEvent, [&](uint64_t, const api::ServerMessage &) { ++events; });
+
+    api::ServerMessage host;
+    host.mutable_host()->mutable_host()->set_name("first");
+    first->pushMessage(host);
+    host.mutable_host()->mutable_host()->set_name("second");
+    second->pushMessage(host);
+    api::ServerMessage note;
+    note.mutable_event()->mutable_event()->mutable_note()->set_key(60);
+    first->pushMessage(note);
+
+    REQUIRE(waitFor([&] {
+        client.poll();
+        return hosts.size() == 2 && events == 1;
+    }));
+    std::ranges::sort(hosts, {}, [](const auto &p) { return p.second; });
+    REQUIRE(hosts[0] == std::pair(first->id(), std::string("first")));
+    REQUIRE(hosts[1] == std::pair(second->id(), std::string("second")));
+
+    api::ClientMessage request;
+    request.mutable_host()->set_request(api::host::Client::CALLBACK);
+    REQUIRE(client.send(second->id(), request));
+    api::ClientMessage received;
+    REQUIRE(second->popFor(&received, 5s));
+    REQUIRE(received.host().request() == api::host::Client::CALLBACK);
+
+    client.disconnect(first->id());
+    REQUIRE_FALSE(client.isConnected(first->id()));
+    REQUIRE(waitFor([&] { return first->numStreams() == 0; }));
+    REQUIRE(second->numStreams() == 1);
+}
+
+TEST_CASE("Reconnect", "[client]")
+{
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    Client client({ .uri = server->uri() });
+    REQUIRE(client.connect(handler->id()));
+    REQUIRE(waitFor([&] { return client.isConnected(handler->id()); }));
+
+    // The server drops the stream, the client opens it again right away.
+    handler->cancelAll();
+    REQUIRE(waitFor([&] { return client.reconnects() == 1; }));
+    REQUIRE(waitFor([&] { return client.isConnected(handler->id()); }));
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    api::ServerMessage host;
+    host.mutable_host()->mutable_host()->set_name("again");
+    handler->pushMessage(host);
+    ReceivedMessage received;
+    REQUIRE(waitFor([&] { return client.tryPop(&received); }));
+    REQUIRE(received.pluginId == handler->id());
+    REQUIRE(received.message.host().host().name() == "again");
+}
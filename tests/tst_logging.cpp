@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include "logging.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+using namespace clap::rpc;
+
+namespace {
+using namespace std::chrono_literals;
+
+template <typename Predicate>
+bool waitFor(Predicate &&predicate, std::chrono::milliseconds timeout = 5s)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+// Encodes the arguments like Log does and formats them like the writer.
+template <typename... Args>
+std::string roundTrip(std::string_view format, Args &&...args)
+{
+    LogRecord record;
+    detail::encodeLogArgs(record.args.data(), record.args.data() + record.args.size(), args...);
+    return detail::formatLogRecord<Args...>(format, record.args.data());
+}
+
+// Captures std::clog. While held, the writer blocks in its next write.
+class CapturedLog final : public std::streambuf
+{
+public:
+    CapturedLog()
+        : mPrevious(std::clog.rdbuf(this))
+    {
+    }
+    ~CapturedLog() override
+    {
+        release();
+        std::clog.rdbuf(mPrevious);
+    }
+
+    void hold()
+    {
+        std::scoped_lock lock(mMtx);
+        mIsHeld = true;
+    }
+    void release()
+    {
+        {
+            std::scoped_lock lock(mMtx);
+            mIsHeld = false;
+        }
+        mReleased.notify_all();
+    }
+    [[nodiscard]] bool isWriterBlocked()
+    {
+        std::scoped_lock lock(mMtx);
+        return mIsBlocked;
+    }
+    [[nodiscard]] std::string text()
+    {
+        std::scoped_lock lock(mMtx);
+        return mText;
+    }
+
+protected:
+    std::streamsize xsputn(const char *data, std::streamsize count) override
+    {
+        std::unique_lock lock(mMtx);
+        mIsBlocked = mIsHeld;
+        mReleased.wait(lock, [this] { return !mIsHeld; });
+        mIsBlocked = false;
+        mText.append(data, static_cast<size_t>(count));
+        return count;
+    }
+    int_type overflow(int_type ch) override
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+        const char c = traits_type::to_char_type(ch);
+        xsputn(&c, 1);
+        return ch;
+    }
+
+private:
+    std::streambuf *mPrevious;
+    std::mutex mMtx;
+    std::condition_variable mReleased;
+    bool mIsHeld = false;
+    bool mIsBlocked = false;
+    std::string mText;
+};
+} // namespace
+
+TEST_CASE("EncodeMixedArgs", "[logging]")
+{
+    const std::string owned = "everything";
+    REQUIRE(roundTrip("{} is {} of {}", "answer", 42, owned) == "answer is 42 of everything");
+    REQUIRE(roundTrip("{}/{}/{}", uint64_t(1) << 40, 'c', std::string_view("sv"))
+        == "1099511627776/c/sv");
+    REQUIRE(roundTrip("{:.2f} {}", 0.5, true) == "0.50 true");
+    REQUIRE(roundTrip("none") == "none");
+}
+
+TEST_CASE("EncodeTruncatesStrings", "[logging]")
+{
+    // The string gives up what the following argument needs.
+    const std::string large(LogRecord::ArgsCapacity + 100, 'x');
+    const size_t room = LogRecord::ArgsCapacity - sizeof(uint16_t) - sizeof(int);
+    REQUIRE(roundTrip("{} {}", large, 42) == std::string(room, 'x') + " 42");
+    REQUIRE(roundTrip("{}", large) == std::string(LogRecord::ArgsCapacity - sizeof(uint16_t), 'x'));
+}
+
+TEST_CASE("DroppedAndFlushed", "[logging]")
+{
+    CapturedLog captured;
+    // Attaches the ring of this thread while nothing is held.
+    Log(INFO, "attached");
+    Logger::instance().flush();
+    REQUIRE(captured.text().find("attached") != std::string::npos);
+
+    // Stall the writer in a write, then overfill the ring.
+    captured.hold();
+    Log(INFO, "stall");
+    REQUIRE(waitFor([&] { return captured.isWriterBlocked(); }));
+    constexpr size_t NumDropped = 10;
+    for (size_t i = 0; i < Logger::RingCapacity + NumDropped; ++i)
+        Log(INFO, "record {}", i);
+    captured.release();
+    Logger::instance().flush();
+
+    // Everything that fit is written in order, followed by the drop count.
+    const std::string text = captured.text();
+    size_t last = text.find("stall");
+    REQUIRE(last != std::string::npos);
+    for (size_t i = 0; i < Logger::RingCapacity; ++i) {
+        const size_t pos = text.find(std::format("record {}\n", i), last);
+        CAPTURE(i);
+        REQUIRE(pos != std::string::npos);
+        last = pos;
+    }
+    REQUIRE(text.find(std::format("record {}\n", Logger::RingCapacity)) == std::string::npos);
+    REQUIRE(text.find(std::format("{} log messages dropped", NumDropped), last)
+        != std::string::npos);
+}
@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include <catch2/catch_test_macros.hpp>
+#include <clap-rpc/coalescingtable.hpp>
+#include <clap-rpc/messagepool.hpp>
+#include <clap-rpc/mpmcqueue.hpp>
+#include <clap-rpc/outboundring.hpp>
+
+#include <array>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace clap::rpc;
+
+TEST_CASE("MoveOnly", "[mpmcqueue]")
+{
+    MpMcQueue<std::unique_ptr<int>, 4> queue;
+    REQUIRE(queue.tryPush(std::make_unique<int>(1)));
+    REQUIRE(queue.emplace(new int(2)));
+
+    std::unique_ptr<int> value;
+    REQUIRE(queue.pop(&value));
+    REQUIRE(*value == 1);
+    REQUIRE(queue.pop(&value));
+    REQUIRE(*value == 2);
+    REQUIRE(!queue.pop(&value));
+}
+
+TEST_CASE("OverflowDropsOldest", "[mpmcqueue]")
+{
+    MpMcQueue<int, 4> queue;
+    for (int i = 0; i < 6; ++i)
+        REQUIRE(queue.push(i));
+    REQUIRE(queue.size() == 4);
+
+    std::array<int, 8> out{};
+    REQUIRE(queue.popN(out.begin(), out.size()) == 4);
+    REQUIRE(out[0] == 2);
+    REQUIRE(out[3] == 5);
+    REQUIRE(queue.isEmpty());
+}
+
+TEST_CASE("BatchPushPop", "[mpmcqueue]")
+{
+    MpMcQueue<int, 8> queue;
+    std::vector<int> in(6);
+    std::iota(in.begin(), in.end(), 0);
+
+    REQUIRE(queue.tryPushN(in.begin(), in.size()) == 6);
+    REQUIRE(queue.tryPushN(in.begin(), in.size()) == 2); // only two cells left
+    REQUIRE(queue.size() == 8);
+
+    std::vector<int> out(3);
+    REQUIRE(queue.popN(out.begin(), out.size()) == 3);
+    REQUIRE(out == std::vector<int>{ 0, 1, 2 });
+
+    // Wraps around and drops the oldest elements to make room.
+    REQUIRE(queue.pushN(in.begin(), in.size()) == 6);
+    out.resize(8);
+    REQUIRE(queue.popN(out.begin(), out.size()) == 8);
+    REQUIRE(out == std::vector<int>{ 0, 1, 0, 1, 2, 3, 4, 5 });
+}
+
+TEST_CASE("ConcurrentBatches", "[mpmcqueue]")
+{
+    constexpr int NumProducers = 4;
+    constexpr int PerProducer = 20'000;
+    MpMcQueue<int, 256> queue;
+
+    std::atomic<long long> sum = 0;
+    std::atomic<int> received = 0;
+    std::vector<std::jthread> threads;
+    for (int p = 0; p < NumProducers; ++p) {
+        threads.emplace_back([&queue] {
+            std::array<int, 16> block{};
+            for (int i = 0; i < PerProducer; i += static_cast<int>(block.size())) {
+                std::iota(block.begin(), block.end(), i);
+                size_t pushed = 0;
+                while (pushed != block.size())
+                    pushed += queue.tryPushN(block.begin() + static_cast<ptrdiff_t>(pushed),
+                        block.size() - pushed);
+            }
+        });
+    }
+    for (int c = 0; c < 2; ++c) {
+        threads.emplace_back([&] {
+            std::array<int, 32> block{};
+            while (received.load() != NumProducers * PerProducer) {
+                const size_t n = queue.popN(block.begin(), block.size());
+                for (size_t i = 0; i < n; ++i)
+                    sum += block[i];
+                received += static_cast<int>(n);
+            }
+        });
+    }
+    threads.clear();
+
+    const long long perProducerSum = static_cast<long long>(PerProducer) * (PerProducer - 1) / 2;
+    REQUIRE(sum == NumProducers * perProducerSum);
+}
+
+TEST_CASE("InterleavedLayout", "[mpmcqueue]")
+{
+    MpMcQueue<int, 64, QueueLayout::Interleaved> queue;
+    for (int i = 0; i < 64; ++i)
+        REQUIRE(queue.tryPush(i));
+    REQUIRE(!queue.tryPush(64));
+
+    int value = -1;
+    for (int i = 0; i < 64; ++i) {
+        REQUIRE(queue.pop(&value));
+        REQUIRE(value == i);
+    }
+    REQUIRE(queue.isEmpty());
+}
+
+TEST_CASE("MessagePool", "[mpmcqueue]")
+{
+    using Pool = MessagePool<std::vector<int>, 4>;
+    Pool pool;
+    Pool::HandleQueue ring;
+
+    std::array<Pool::Handle, 4> handles{};
+    for (auto &handle : handles) {
+        handle = pool.acquire();
+        REQUIRE(handle != Pool::InvalidHandle);
+        pool[handle].assign(3, static_cast<int>(handle));
+        REQUIRE(ring.tryPush(handle));
+    }
+    REQUIRE(pool.acquire() == Pool::InvalidHandle);
+
+    Pool::Handle handle = Pool::InvalidHandle;
+    REQUIRE(ring.pop(&handle));
+    REQUIRE(pool[handle] == std::vector<int>(3, static_cast<int>(handles[0])));
+    pool.release(handle);
+    REQUIRE(pool.available() == 1);
+    REQUIRE(pool.acquire() == handle);
+
+    // Retired slots come back once the consumer recycled them.
+    pool.retire(handle);
+    REQUIRE(pool.available() == 0);
+    REQUIRE(pool.retired() == 1);
+    REQUIRE(pool.reclaim([](std::vector<int> &slot) { slot.clear(); }) == 1);
+    REQUIRE(pool.acquire() == handle);
+    REQUIRE(pool[handle].empty());
+
+    Pool small(2);
+    REQUIRE(small.size() == 2);
+    REQUIRE(small.acquire() != Pool::InvalidHandle);
+    REQUIRE(small.acquire() != Pool::InvalidHandle);
+    REQUIRE(small.acquire() == Pool::InvalidHandle);
+
+    // The reserve is refilled before any slot is freed again.
+    Pool reserved(2);
+    const auto spare = reserved.acquire();
+    reserved.keepReserve(spare);
+    const auto first = reserved.acquire();
+    REQUIRE(reserved.acquire() == Pool::InvalidHandle);
+    REQUIRE(reserved.acquireReserve() == spare);
+    REQUIRE(reserved.acquireReserve() == Pool::InvalidHandle);
+    reserved.retire(first);
+    REQUIRE(reserved.reclaim([](std::vector<int> &slot) { slot.clear(); }) == 1);
+    REQUIRE(reserved.acquire() == Pool::InvalidHandle);
+    REQUIRE(reserved.acquireReserve() == first);
+    reserved.retire(spare);
+    reserved.retire(first);
+    REQUIRE(reserved.reclaim([](std::vector<int> &slot) { slot.clear(); }) == 2);
+    REQUIRE(reserved.acquireReserve() == spare);
+    REQUIRE(reserved.acquire() == first);
+}
+
+TEST_CASE("CoalescingTable", "[mpmcqueue]")
+{
+    CoalescingTable<4> table;
+    // Kind::None is null whatever its id.
+    REQUIRE(CoalescingKey{ CoalescingKey::Kind::None, 7 }.isNull());
+    REQUIRE(table.entry({ CoalescingKey::Kind::None, 7 }) == CoalescingTable<4>::InvalidEntry);
+    REQUIRE(table.entry({}) == CoalescingTable<4>::InvalidEntry);
+
+    const auto entry = table.entry(CoalescingKey::parameter(7));
+    REQUIRE(entry != CoalescingTable<4>::InvalidEntry);
+    REQUIRE(table.entry(CoalescingKey::parameter(7)) == entry);
+    REQUIRE(table.key(entry) == CoalescingKey::parameter(7));
+    REQUIRE(table.exchange(entry, 1) == CoalescingTable<4>::InvalidHandle);
+    REQUIRE(table.exchange(entry, 2) == 1);
+    REQUIRE(table.take(entry) == 2);
+
+    // The table holds four keys, further ones aren't coalesced.
+    REQUIRE(table.entry(CoalescingKey::transport()) != CoalescingTable<4>::InvalidEntry);
+    REQUIRE(table.entry(CoalescingKey::guiSize()) != CoalescingTable<4>::InvalidEntry);
+    REQUIRE(table.entry(CoalescingKey::parameter(8)) != CoalescingTable<4>::InvalidEntry);
+    REQUIRE(table.entry(CoalescingKey::parameter(9)) == CoalescingTable<4>::InvalidEntry);
+}
+
+TEST_CASE("OutboundRing", "[mpmcqueue]")
+{
+    OutboundRing<std::unique_ptr<int>> ring(5);
+    REQUIRE(ring.capacity() == 8);
+    for (int i = 0; i < 8; ++i)
+        REQUIRE(ring.tryPush(std::make_unique<int>(i)));
+    REQUIRE_FALSE(ring.tryPush(std::make_unique<int>(8)));
+    REQUIRE(ring.size() == 8);
+
+    // The producer evicts the oldest element to make room.
+    std::unique_ptr<int> value;
+    REQUIRE(ring.pop(&value));
+    REQUIRE(*value == 0);
+    REQUIRE(ring.tryPush(std::make_unique<int>(8)));
+    for (int i = 1; i <= 8; ++i) {
+        REQUIRE(ring.pop(&value));
+        REQUIRE(*value == i);
+    }
+    REQUIRE(ring.isEmpty());
+
+    // One producer that also evicts, racing against a consumer.
+    constexpr int NumValues = 100'000;
+    OutboundRing<int> shared(64);
+    std::atomic<int> consumed = 0;
+    std::atomic<int> evicted = 0;
+    std::atomic<bool> done = false;
+    std::atomic<bool> ordered = true;
+    std::jthread consumer([&] {
+        int last = -1;
+        int v = 0;
+        while (!done.load() || !shared.isEmpty()) {
+            if (shared.pop(&v)) {
+                if (v <= last)
+                    ordered = false;
+                last = v;
+                ++consumed;
+            }
+        }
+    });
+    for (int i = 0; i < NumValues; ++i) {
+        int v = 0;
+        while (!shared.tryPush(int(i))) {
+            if (shared.pop(&v))
+                ++evicted;
+        }
+    }
+    done = true;
+    consumer.join();
+    REQUIRE(ordered);
+    REQUIRE(consumed + evicted == NumValues);
+}
+
+TEST_CASE("OutboundRingProducers", "[mpmcqueue]")
+{
+    // Several producers that also evict, as for a multiplexed stream.
+    constexpr int NumProducers = 4;
+    constexpr int NumValues = 50'000;
+    OutboundRing<int> ring(64);
+    std::atomic<int> consumed = 0;
+    std::atomic<int> evicted = 0;
+    std::atomic<int> finished = 0;
+    std::atomic<bool> ordered = true;
+    std::jthread consumer([&] {
+        std::array<int, NumProducers> last;
+        last.fill(-1);
+        int v = 0;
+        while (finished.load() != NumProducers || !ring.isEmpty()) {
+            if (!ring.pop(&v))
+                continue;
+            const int producer = v / NumValues;
+            if (v % NumValues <= last[size_t(producer)])
+                ordered = false;
+            last[size_t(producer)] = v % NumValues;
+            ++consumed;
+        }
+    });
+    {
+        std::vector<std::jthread> producers;
+        for (int p = 0; p < NumProducers; ++p) {
+            producers.emplace_back([&, p] {
+                for (int i = 0; i < NumValues; ++i) {
+                    int v = 0;
+                    while (!ring.tryPush(p * NumValues + i)) {
+                        if (ring.pop(&v))
+                            ++evicted;
+                    }
+                }
+                ++finished;
+            });
+        }
+    }
+    consumer.join();
+    REQUIRE(ordered);
+    REQUIRE(consumed + evicted == NumProducers * NumValues);
+}
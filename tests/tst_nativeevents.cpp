@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include <catch2/catch_test_macros.hpp>
+#include <clap-rpc/tools/nativeevents.hpp>
+
+#include <string>
+
+using namespace clap::rpc;
+
+TEST_CASE("RoundTrip", "[nativeevents]")
+{
+    clap_event_note_t note = {};
+    note.header = { sizeof(note), 3, CLAP_CORE_EVENT_SPACE_ID, CLAP_EVENT_NOTE_ON, 0 };
+    note.note_id = 7;
+    note.port_index = 1;
+    note.channel = 2;
+    note.key = 60;
+    note.velocity = 0.75;
+
+    clap_event_param_mod_t mod = {};
+    mod.header = { sizeof(mod), 5, CLAP_CORE_EVENT_SPACE_ID, CLAP_EVENT_PARAM_MOD, 1 };
+    mod.param_id = 42;
+    mod.cookie = &mod;
+    mod.note_id = -1;
+    mod.amount = -0.25;
+
+    clap_event_midi_t midi = {};
+    midi.header = { sizeof(midi), 9, CLAP_CORE_EVENT_SPACE_ID, CLAP_EVENT_MIDI, 0 };
+    midi.port_index = 3;
+    midi.data[0] = 0x90;
+    midi.data[1] = 64;
+    midi.data[2] = 127;
+
+    clap_event_transport_t transport = {};
+    transport.header = { sizeof(transport), 0, CLAP_CORE_EVENT_SPACE_ID, CLAP_EVENT_TRANSPORT, 0 };
+
+    api::ServerMessage sent;
+    auto *events = sent.mutable_event()->mutable_native();
+    events->set_steady_time(4096);
+    native::EventWriter writer(events, 4);
+    REQUIRE(writer.append(&note.header));
+    REQUIRE(writer.append(&mod.header));
+    REQUIRE(writer.append(&midi.header));
+    REQUIRE_FALSE(writer.append(&transport.header));
+    REQUIRE(writer.size()
+        == sizeof(native::NoteRecord) + sizeof(native::ParamRecord) + sizeof(native::MidiRecord));
+
+    api::ServerMessage received;
+    REQUIRE(received.ParseFromString(sent.SerializeAsString()));
+    REQUIRE(received.event().has_native());
+    REQUIRE(received.event().native().steady_time() == 4096);
+
+    native::EventReader reader(received.event().native());
+    native::Header header = {};
+
+    REQUIRE(reader.next(&header));
+    REQUIRE(header.type == CLAP_EVENT_NOTE_ON);
+    REQUIRE(header.time == 3);
+    native::NoteRecord noteRecord = {};
+    REQUIRE(reader.read(&noteRecord));
+    REQUIRE(noteRecord.noteId == 7);
+    REQUIRE(noteRecord.portIndex == 1);
+    REQUIRE(noteRecord.channel == 2);
+    REQUIRE(noteRecord.key == 60);
+    REQUIRE(noteRecord.velocity == 0.75);
+
+    REQUIRE(reader.next(&header));
+    REQUIRE(header.type == CLAP_EVENT_PARAM_MOD);
+    REQUIRE(header.flags == 1);
+    native::ParamRecord paramRecord = {};
+    REQUIRE(reader.read(&paramRecord));
+    REQUIRE(paramRecord.paramId == 42);
+    REQUIRE(paramRecord.noteId == -1);
+    REQUIRE(paramRecord.value == -0.25);
+
+    REQUIRE(reader.next(&header));
+    REQUIRE(header.type == CLAP_EVENT_MIDI);
+    native::NoteRecord tooLarge = {};
+    REQUIRE_FALSE(reader.read(&tooLarge));
+    native::MidiRecord midiRecord = {};
+    REQUIRE(reader.read(&midiRecord));
+    REQUIRE(midiRecord.portIndex == 3);
+    REQUIRE(midiRecord.data[0] == 0x90);
+    REQUIRE(midiRecord.data[2] == 127);
+
+    REQUIRE_FALSE(reader.next(&header));
+}
+
+TEST_CASE("MalformedInput", "[nativeevents]")
+{
+    api::event::NativeEvents events;
+    native::EventWriter writer(&events);
+    writer.append(native::ParamGestureRecord{
+        { 0, 0, CLAP_CORE_EVENT_SPACE_ID, CLAP_EVENT_PARAM_GESTURE_BEGIN, 0 }, 1, 0 });
+    writer.append(native::ParamGestureRecord{
+        { 0, 0, CLAP_CORE_EVENT_SPACE_ID, CLAP_EVENT_PARAM_GESTURE_END, 0 }, 1, 0 });
+    native::Header header = {};
+
+    SECTION("Truncated")
+    {
+        events.mutable_records()->resize(sizeof(native::ParamGestureRecord) + 20);
+        native::EventReader reader(events);
+        REQUIRE(reader.next(&header));
+        REQUIRE_FALSE(reader.next(&header));
+    }
+
+    SECTION("InvalidSize")
+    {
+        const uint32_t size = 4;
+        events.mutable_records()->replace(0, sizeof(size), reinterpret_cast<const char *>(&size),
+            sizeof(size));
+        native::EventReader reader(events);
+        REQUIRE_FALSE(reader.next(&header));
+    }
+
+    SECTION("UnknownVersion")
+    {
+        events.set_version(native::FormatVersion + 1);
+        native::EventReader reader(events);
+        REQUIRE_FALSE(reader.next(&header));
+    }
+}
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
+
+#include <catch2/catch_test_macros.hpp>
+#include <clap-rpc/server.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+
+// Allocation hook: counts every allocation and deallocation made by the
+// current thread while an AllocationCounter is alive.
+namespace {
+thread_local size_t *tAllocations = nullptr;
+
+struct AllocationCounter
+{
+    AllocationCounter()
+    {
+        tAllocations = &count;
+    }
+    ~AllocationCounter()
+    {
+        tAllocations = nullptr;
+    }
+    size_t count = 0;
+};
+
+void countAllocation() noexcept
+{
+    if (tAllocations)
+        ++*tAllocations;
+}
+
+template <typename Predicate>
+bool waitFor(Predicate &&predicate)
+{
+    using namespace std::chrono_literals;
+    const auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+    countAllocation();
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (ptr)
+        countAllocation();
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    ::operator delete(ptr);
+}
+
+TEST_CASE("AllocationHook", "[realtime]")
+{
+    AllocationCounter counter;
+    std::string heap(64, 'x');
+    REQUIRE(heap.size() == 64);
+    REQUIRE(counter.count == 1);
+}
+
+TEST_CASE("PooledPushDoesNotAllocate", "[realtime]")
+{
+    using namespace clap::rpc;
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    // Every slot is taken several times, each time after the dispatch worker
+    // recycled it, so the arena is reset on another thread in between.
+    for (int block = 0; block < 4 * int(ServerMessagePool::capacity()); ++block) {
+        {
+            AllocationCounter counter;
+            auto message = handler->acquireMessage();
+            REQUIRE(message);
+            auto *event = message->mutable_event()->mutable_event();
+            event->set_type(api::event::EventMessage::NOTE);
+            auto *note = event->mutable_note();
+            note->set_type(api::event::Note::ON);
+            note->set_key(block % 128);
+            note->set_velocity(0.5);
+            handler->pushMessage(std::move(message));
+            REQUIRE(counter.count == 0);
+        }
+        REQUIRE(waitFor([&] { return handler->stats().dispatchedMessages == uint64_t(block + 1); }));
+    }
+    REQUIRE(handler->stats().droppedMessages == 0);
+}
+
+TEST_CASE("ExhaustedPoolDoesNotAllocate", "[realtime]")
+{
+    using namespace clap::rpc;
+    // A slot and the reserve run out all the time. Messages outgrow the
+    // arena's initial block and own heap strings, so a sacrificed slot goes
+    // to the worker and the reserve is handed out, or nothing if it is out.
+    Server::configure({ .addressUri = "localhost:0", .messagePoolSize = 2 });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+    const std::string payload(2 * ArenaMessage::BlockSize, 'x');
+
+    for (int block = 0; block < 10'000; ++block) {
+        PooledMessage message;
+        {
+            AllocationCounter counter;
+            message = handler->acquireMessage();
+            REQUIRE(counter.count == 0);
+        }
+        if (!message)
+            continue;
+        auto *descriptor = message->mutable_plugin()->mutable_args()->mutable_description();
+        descriptor->set_name(payload);
+        for (int i = 0; i < 64; ++i)
+            descriptor->add_features("feature");
+        if (block % 2 == 0) {
+            AllocationCounter counter;
+            handler->pushMessage(std::move(message));
+            REQUIRE(counter.count == 0);
+        } else {
+            // Dropping an unpublished message mustn't free it here either.
+            AllocationCounter counter;
+            message.reset();
+            REQUIRE(counter.count == 0);
+        }
+    }
+    REQUIRE(handler->stats().droppedMessages > 0);
+}
@@ -2,7 +2,94 @@
 // Copyright (c) 2025 Dennis Oberst <dennis.ob@protonmail.com>
 
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
+#include <clap-rpc/api/clapservice.grpc.pb.h>
+#include <clap-rpc/coroutine.hpp>
 #include <clap-rpc/server.hpp>
+#include <clap-rpc/sharedring.hpp>
+
+#include <grpcpp/create_channel.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+using namespace std::chrono_literals;
+
+template <typename Predicate>
+bool waitFor(Predicate &&predicate, std::chrono::milliseconds timeout = 5s)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+std::unique_ptr<api::ClapService::Stub> newStub(const clap::rpc::Server &server)
+{
+    return api::ClapService::NewStub(
+        grpc::CreateChannel(server.uri(), grpc::InsecureChannelCredentials()));
+}
+
+// The EventStream of one plugin, cancelled when it goes out of scope.
+class EventStream
+{
+public:
+    using Call = grpc::ClientReaderWriter<api::ClientMessage, api::ServerMessage>;
+
+    EventStream(api::ClapService::Stub &stub, uint64_t pluginId)
+        : mContext(std::make_unique<grpc::ClientContext>())
+    {
+        mContext->AddMetadata("plugin_id", std::to_string(pluginId));
+        mCall = stub.EventStream(mContext.get());
+    }
+    EventStream(EventStream &&) noexcept = default;
+    EventStream &operator=(EventStream &&) = delete;
+    ~EventStream()
+    {
+        if (mCall) {
+            tryCancel();
+            finish();
+        }
+    }
+
+    Call *operator->() const noexcept
+    {
+        return mCall.get();
+    }
+
+    // Ends blocking reads and writes, safe while another thread uses them.
+    void tryCancel()
+    {
+        mContext->TryCancel();
+    }
+    // Waits for the server to end the call.
+    grpc::Status finish()
+    {
+        auto status = mCall->Finish();
+        mCall.reset();
+        return status;
+    }
+
+private:
+    std::unique_ptr<grpc::ClientContext> mContext;
+    std::unique_ptr<Call> mCall;
+};
+} // namespace
 
 TEST_CASE("StartStop", "[server]")
 {
@@ -23,3 +110,1083 @@ TEST_CASE("CreateStreamHandler", "[server]")
     // server.reset();
 }
 
+
+TEST_CASE("ShardedDispatch", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0", .dispatchWorkers = 2 });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+
+    constexpr int NumHandlers = 4;
+    constexpr int NumMessages = 64;
+
+    auto stub = newStub(*server);
+    std::vector<std::shared_ptr<StreamHandler>> handlers;
+    std::vector<EventStream> clients;
+    for (int i = 0; i < NumHandlers; ++i) {
+        const auto &handler = handlers.emplace_back(server->createStreamHandler());
+        clients.emplace_back(*stub, handler->id());
+    }
+    for (const auto &handler : handlers)
+        REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    for (int n = 0; n < NumMessages; ++n) {
+        for (const auto &handler : handlers) {
+            api::ServerMessage message;
+            message.mutable_host()->mutable_host()->set_name(std::to_string(n));
+            handler->pushMessage(std::move(message));
+        }
+    }
+
+    for (const auto &client : clients) {
+        api::ServerMessage message;
+        for (int n = 0; n < NumMessages; ++n) {
+            REQUIRE(client->Read(&message));
+            REQUIRE(message.host().host().name() == std::to_string(n));
+        }
+    }
+}
+
+TEST_CASE("ScheduleWakeups", "[server]")
+{
+    using namespace clap::rpc;
+    // The worker parks as soon as its ready list is empty. A push racing
+    // with the worker going to sleep must still wake it, a lost wakeup would
+    // stall the handler for good.
+    Server::configure({ .addressUri = "localhost:0",
+        .dispatchWorkers = 1,
+        .workerWait = { .spinCount = 0, .yieldCount = 0 } });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    constexpr uint64_t NumRounds = 1000;
+    api::ServerMessage message;
+    message.mutable_host()->mutable_host()->set_name("wakeup");
+    for (uint64_t round = 1; round <= NumRounds; ++round) {
+        handler->pushMessage(message);
+        REQUIRE(waitFor([&] { return handler->stats().dispatchedMessages == round; }));
+    }
+}
+
+TEST_CASE("SharedBroadcast", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    constexpr int NumClients = 3;
+    constexpr int NumMessages = 32;
+
+    auto stub = newStub(*server);
+    std::vector<EventStream> clients;
+    for (int i = 0; i < NumClients; ++i)
+        clients.emplace_back(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == NumClients; }));
+
+    // Cover every wire buffer size class as well as the unpooled fallback.
+    const auto nameFor = [](int n) { return std::string(size_t(1) << (n % 14), 'a' + n % 26); };
+    for (int n = 0; n < NumMessages; ++n) {
+        api::ServerMessage message;
+        message.mutable_host()->mutable_host()->set_name(nameFor(n));
+        handler->pushMessage(std::move(message));
+    }
+
+    for (const auto &client : clients) {
+        api::ServerMessage message;
+        for (int n = 0; n < NumMessages; ++n) {
+            REQUIRE(client->Read(&message));
+            REQUIRE(message.host().host().name() == nameFor(n));
+        }
+    }
+}
+
+TEST_CASE("StreamChurn", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    // Streams come and go while the handler keeps broadcasting.
+    std::atomic<bool> isDone = false;
+    std::thread broadcaster([&] {
+        api::ServerMessage message;
+        message.mutable_host()->mutable_host()->set_name("churn");
+        while (!isDone.load())
+            handler->broadcast(message);
+    });
+    std::atomic<bool> sawLast = false;
+    std::thread reader([&] {
+        api::ServerMessage message;
+        while (client->Read(&message)) {
+            if (message.host().host().name() == "last") {
+                sawLast = true;
+                return;
+            }
+        }
+    });
+
+    constexpr int NumRounds = 8;
+    constexpr int NumClients = 4;
+    bool isChurned = true;
+    for (int round = 0; round < NumRounds && isChurned; ++round) {
+        std::vector<EventStream> clients;
+        for (int i = 0; i < NumClients; ++i)
+            clients.emplace_back(*stub, handler->id());
+        isChurned = waitFor([&] { return handler->numStreams() == NumClients + 1; });
+    }
+    isChurned = isChurned && waitFor([&] { return handler->numStreams() == 1; });
+
+    isDone = true;
+    broadcaster.join();
+    api::ServerMessage last;
+    last.mutable_host()->mutable_host()->set_name("last");
+    handler->broadcast(last);
+    // A failed round must not leave the reader blocked.
+    if (!isChurned)
+        client.tryCancel();
+    reader.join();
+    REQUIRE(isChurned);
+    REQUIRE(sawLast);
+}
+
+TEST_CASE("EventBatch", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    constexpr uint32_t NumEvents = 256;
+    REQUIRE_FALSE(handler->commitBatch(handler->openBatch(0, 64)));
+
+    auto batch = handler->openBatch(1024, NumEvents);
+    REQUIRE(batch);
+    for (uint32_t i = 0; i < NumEvents; ++i) {
+        auto *event = StreamHandler::appendEvent(batch);
+        REQUIRE(event);
+        event->set_type(api::event::EventMessage::PARAMETER);
+        event->set_time(i);
+        event->mutable_param()->set_param_id(i);
+        event->mutable_param()->set_value(i * 0.5);
+    }
+    REQUIRE(handler->commitBatch(std::move(batch)));
+    REQUIRE_FALSE(batch);
+
+    api::ServerMessage message;
+    REQUIRE(client->Read(&message));
+    REQUIRE(message.event().has_batch());
+    const auto &received = message.event().batch();
+    REQUIRE(received.steady_time() == 1024);
+    REQUIRE(received.frames_count() == NumEvents);
+    REQUIRE(received.events_size() == int(NumEvents));
+    for (uint32_t i = 0; i < NumEvents; ++i) {
+        const auto &event = received.events(int(i));
+        REQUIRE(event.time() == i);
+        REQUIRE(event.param().param_id() == i);
+        REQUIRE(event.param().value() == i * 0.5);
+    }
+}
+
+TEST_CASE("Subscriptions", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream all(*stub, handler->id());
+    EventStream gui(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 2; }));
+
+    // Only parameters 7 and 9, but not 9 after all, and no MIDI.
+    const auto subscribe = [&gui](api::event::Client::Request request,
+                               std::vector<uint32_t> ids = {}) {
+        api::ClientMessage message;
+        message.mutable_event()->set_request(request);
+        for (const auto id : ids)
+            message.mutable_event()->add_param_ids(id);
+        REQUIRE(gui->Write(message));
+    };
+    subscribe(api::event::Client::MIDI_DISABLE);
+    subscribe(api::event::Client::PARAM_DISABLE);
+    subscribe(api::event::Client::PARAM_ENABLE, { 7, 9 });
+    subscribe(api::event::Client::PARAM_DISABLE, { 9 });
+    // Requests are handled by the stream, this one reaches the handler.
+    api::ClientMessage marker;
+    marker.mutable_plugin()->set_request(api::plugin::Client::DESCRIPTOR);
+    REQUIRE(gui->Write(marker));
+    REQUIRE(handler->popFor(&marker, 5s));
+    REQUIRE(marker.has_plugin());
+
+    const auto param = [](api::event::EventMessage *event, uint32_t id) {
+        event->set_type(api::event::EventMessage::PARAMETER);
+        event->mutable_param()->set_param_id(id);
+    };
+    const auto midi = [](api::event::EventMessage *event) {
+        event->set_type(api::event::EventMessage::MIDI);
+        event->mutable_midi()->set_data("\x90\x40\x7f");
+    };
+    for (const uint32_t id : { 3u, 7u, 9u }) {
+        api::ServerMessage message;
+        param(message.mutable_event()->mutable_event(), id);
+        handler->broadcast(message);
+    }
+    api::ServerMessage single;
+    midi(single.mutable_event()->mutable_event());
+    handler->broadcast(single);
+
+    api::ServerMessage batch;
+    auto *events = batch.mutable_event()->mutable_batch();
+    events->set_steady_time(512);
+    param(events->add_events(), 3);
+    midi(events->add_events());
+    param(events->add_events(), 7);
+    events->add_events()->mutable_note()->set_key(60);
+    handler->broadcast(batch);
+
+    api::ServerMessage bye;
+    bye.mutable_host()->mutable_host()->set_name("bye");
+    handler->broadcast(bye);
+
+    api::ServerMessage message;
+    for (const uint32_t id : { 3u, 7u, 9u }) {
+        REQUIRE(all->Read(&message));
+        REQUIRE(message.event().event().param().param_id() == id);
+    }
+    REQUIRE(all->Read(&message));
+    REQUIRE(message.event().event().has_midi());
+    REQUIRE(all->Read(&message));
+    REQUIRE(message.event().batch().events_size() == 4);
+    REQUIRE(all->Read(&message));
+    REQUIRE(message.host().host().name() == "bye");
+
+    REQUIRE(gui->Read(&message));
+    REQUIRE(message.event().event().param().param_id() == 7);
+    REQUIRE(gui->Read(&message));
+    REQUIRE(message.event().batch().steady_time() == 512);
+    REQUIRE(message.event().batch().events_size() == 2);
+    REQUIRE(message.event().batch().events(0).param().param_id() == 7);
+    REQUIRE(message.event().batch().events(1).note().key() == 60);
+    REQUIRE(gui->Read(&message));
+    REQUIRE(message.host().host().name() == "bye");
+}
+
+TEST_CASE("Multiplexed", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto first = server->createStreamHandler();
+    auto second = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    grpc::ClientContext context;
+    auto client = stub->MultiplexStream(&context);
+
+    api::MultiplexServerMessage reply;
+    const auto request = [&](uint32_t tag, auto &&fill) {
+        api::MultiplexClientMessage message;
+        message.set_tag(tag);
+        fill(message);
+        REQUIRE(client->Write(message));
+    };
+    const auto expectStatus = [&](uint32_t tag, bool ok) {
+        REQUIRE(client->Read(&reply));
+        REQUIRE(reply.tag() == tag);
+        REQUIRE(reply.has_status());
+        REQUIRE(reply.status().error().empty() == ok);
+    };
+    request(1, [&](auto &m) { m.set_subscribe(first->id()); });
+    expectStatus(1, true);
+    request(2, [&](auto &m) { m.set_subscribe(second->id()); });
+    expectStatus(2, true);
+    request(2, [&](auto &m) { m.set_subscribe(first->id()); });
+    expectStatus(2, false);
+    request(0, [&](auto &m) { m.set_subscribe(first->id()); });
+    expectStatus(0, false);
+    request(3, [](auto &m) { m.set_subscribe(~uint64_t(0)); });
+    expectStatus(3, false);
+    REQUIRE(first->numStreams() == 1);
+    REQUIRE(second->numStreams() == 1);
+
+    // Messages for a tag reach its plugin, requests apply to that tag only.
+    request(2, [](auto &m) {
+        m.mutable_message()->mutable_plugin()->set_request(api::plugin::Client::DESCRIPTOR);
+    });
+    api::ClientMessage received;
+    REQUIRE(second->popFor(&received, 5s));
+    REQUIRE(received.has_plugin());
+    request(1, [](auto &m) {
+        m.mutable_message()->mutable_event()->set_request(api::event::Client::MIDI_DISABLE);
+    });
+    request(1, [](auto &m) {
+        m.mutable_message()->mutable_plugin()->set_request(api::plugin::Client::DESCRIPTOR);
+    });
+    REQUIRE(first->popFor(&received, 5s));
+    REQUIRE(received.has_plugin());
+
+    api::ServerMessage midi;
+    midi.mutable_event()->mutable_event()->mutable_midi()->set_data("\x90\x40\x7f");
+    first->broadcast(midi);
+    second->broadcast(midi);
+    api::ServerMessage name;
+    name.mutable_host()->mutable_host()->set_name("first");
+    first->broadcast(name);
+    name.mutable_host()->mutable_host()->set_name("second");
+    second->broadcast(name);
+
+    REQUIRE(client->Read(&reply));
+    REQUIRE(reply.tag() == 2);
+    REQUIRE(reply.message().event().event().has_midi());
+    for (const auto &[tag, expected] : { std::pair(1u, "first"), std::pair(2u, "second") }) {
+        REQUIRE(client->Read(&reply));
+        REQUIRE(reply.tag() == tag);
+        REQUIRE(reply.message().host().host().name() == expected);
+    }
+
+    request(2, [](auto &m) { m.set_unsubscribe(true); });
+    expectStatus(2, true);
+    REQUIRE(second->numStreams() == 0);
+    request(2, [](auto &m) { m.set_unsubscribe(true); });
+    expectStatus(2, false);
+    second->broadcast(name);
+    name.mutable_host()->mutable_host()->set_name("bye");
+    first->broadcast(name);
+    REQUIRE(client->Read(&reply));
+    REQUIRE(reply.tag() == 1);
+    REQUIRE(reply.message().host().host().name() == "bye");
+
+    context.TryCancel();
+    client->Finish();
+    REQUIRE(waitFor([&] { return first->numStreams() == 0; }));
+}
+
+TEST_CASE("MultiplexedProducers", "[server]")
+{
+    using namespace clap::rpc;
+    // The handlers are dispatched by different workers and a user thread
+    // broadcasts on its own, all of them write to the same stream.
+    Server::configure({ .addressUri = "localhost:0",
+        .dispatchWorkers = 2,
+        .streamLimits = { .maxQueuedMessages = 8192 } });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto first = server->createStreamHandler();
+    auto second = server->createStreamHandler();
+    REQUIRE(first->stats().worker != second->stats().worker);
+
+    auto stub = newStub(*server);
+    grpc::ClientContext context;
+    auto client = stub->MultiplexStream(&context);
+    api::MultiplexServerMessage reply;
+    for (const auto &[tag, handler] : { std::pair(1u, first), std::pair(2u, second) }) {
+        api::MultiplexClientMessage message;
+        message.set_tag(tag);
+        message.set_subscribe(handler->id());
+        REQUIRE(client->Write(message));
+        REQUIRE(client->Read(&reply));
+        REQUIRE(reply.status().error().empty());
+    }
+
+    // Names are "<source> <sequence>", every source is read back in order.
+    constexpr int NumMessages = 2000;
+    constexpr int NumSources = 3;
+    std::atomic<int> received = 0;
+    std::atomic<bool> ordered = true;
+    std::jthread reader([&] {
+        std::array<int, NumSources> last;
+        last.fill(-1);
+        api::MultiplexServerMessage message;
+        while (client->Read(&message)) {
+            const auto &name = message.message().host().host().name();
+            const int source = name[0] - '0';
+            const int sequence = std::stoi(name.substr(2));
+            const bool isTagged = message.tag() == (source == 1 ? 2u : 1u);
+            if (!isTagged || sequence <= last[size_t(source)])
+                ordered = false;
+            last[size_t(source)] = sequence;
+            ++received;
+        }
+    });
+
+    const auto produce = [&](int source, StreamHandler &handler, bool isPushing) {
+        api::ServerMessage message;
+        for (int i = 0; i < NumMessages; ++i) {
+            message.mutable_host()->mutable_host()->set_name(
+                std::to_string(source) + " " + std::to_string(i));
+            if (!isPushing) {
+                handler.broadcast(message);
+                continue;
+            }
+            // Stay well below the pool size, nothing may be dropped.
+            while (handler.stats().pendingMessages > 32)
+                std::this_thread::yield();
+            handler.pushMessage(message);
+        }
+    };
+    {
+        std::jthread pushFirst(produce, 0, std::ref(*first), true);
+        std::jthread pushSecond(produce, 1, std::ref(*second), true);
+        std::jthread broadcastFirst(produce, 2, std::ref(*first), false);
+    }
+    const bool isComplete = waitFor([&] { return received == NumSources * NumMessages; }, 10s);
+    context.TryCancel();
+    reader.join();
+    client->Finish();
+    REQUIRE(isComplete);
+    REQUIRE(ordered);
+    REQUIRE(first->stats().droppedMessages == 0);
+    REQUIRE(second->stats().droppedMessages == 0);
+}
+
+TEST_CASE("CoalescedPush", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    const auto pushNote = [&](api::event::Note::Type type) {
+        auto message = handler->acquireMessage();
+        auto *event = message->mutable_event()->mutable_event();
+        event->set_type(api::event::EventMessage::NOTE);
+        event->mutable_note()->set_type(type);
+        handler->pushMessage(std::move(message));
+    };
+
+    // Far more values than the pool has slots. Without coalescing the burst
+    // would evict the note-on before the worker gets to it.
+    constexpr uint32_t NumParams = 4;
+    constexpr uint32_t NumValues = 1024;
+    pushNote(api::event::Note::ON);
+    for (uint32_t i = 0; i < NumValues; ++i) {
+        const uint32_t paramId = i % NumParams;
+        auto message = handler->acquireMessage();
+        REQUIRE(message);
+        auto *event = message->mutable_event()->mutable_event();
+        event->set_type(api::event::EventMessage::PARAMETER);
+        event->mutable_param()->set_param_id(paramId);
+        event->mutable_param()->set_value(double(i));
+        handler->pushMessage(std::move(message), CoalescingKey::parameter(paramId));
+    }
+    pushNote(api::event::Note::OFF);
+
+    std::vector<double> lastValue(NumParams, -1.0);
+    std::vector<api::event::Note::Type> notes;
+    api::ServerMessage message;
+    while (notes.size() != 2 && client->Read(&message)) {
+        const auto &event = message.event().event();
+        if (event.has_note()) {
+            notes.emplace_back(event.note().type());
+        } else {
+            REQUIRE(event.param().value() > lastValue[event.param().param_id()]);
+            lastValue[event.param().param_id()] = event.param().value();
+        }
+    }
+    REQUIRE(notes == std::vector{ api::event::Note::ON, api::event::Note::OFF });
+    for (uint32_t paramId = 0; paramId < NumParams; ++paramId)
+        REQUIRE(lastValue[paramId] == double(NumValues - NumParams + paramId));
+}
+
+TEST_CASE("PriorityLanes", "[server]")
+{
+    using namespace clap::rpc;
+    api::ServerMessage note;
+    note.mutable_event()->mutable_event()->mutable_note()->set_type(api::event::Note::ON);
+    api::ServerMessage transport;
+    transport.mutable_event()->mutable_event()->mutable_transport()->set_flags(1);
+    api::ServerMessage host;
+    host.mutable_host()->mutable_host()->set_name("bulk");
+    REQUIRE(StreamHandler::laneFor(note) == MessageLane::Realtime);
+    REQUIRE(StreamHandler::laneFor(transport) == MessageLane::State);
+    REQUIRE(StreamHandler::laneFor(host) == MessageLane::Bulk);
+
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    // Everything is queued before the worker is notified, the note pushed
+    // last overtakes the transport update and the bulk messages.
+    std::vector<api::ServerMessage> messages(8, host);
+    messages.emplace_back(transport);
+    messages.emplace_back(note);
+    handler->pushMessages(messages);
+
+    api::ServerMessage message;
+    REQUIRE(client->Read(&message));
+    REQUIRE(message.event().event().has_note());
+    REQUIRE(client->Read(&message));
+    REQUIRE(message.event().event().has_transport());
+    for (int i = 0; i < 8; ++i) {
+        REQUIRE(client->Read(&message));
+        REQUIRE(message.has_host());
+    }
+}
+
+TEST_CASE("SlowConsumer", "[server]")
+{
+    using namespace clap::rpc;
+    const auto policy = GENERATE(SlowConsumerPolicy::DropOldest, SlowConsumerPolicy::Coalesce,
+        SlowConsumerPolicy::Cancel);
+    constexpr size_t Limit = 8;
+    Server::configure({ .addressUri = "localhost:0",
+        .streamLimits = { .maxQueuedMessages = Limit, .policy = policy } });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    // The client never reads, the transport soon stops taking writes.
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    api::ServerMessage message;
+    message.mutable_host()->mutable_host()->set_name(std::string(size_t(64) << 10, 'x'));
+    for (int i = 0; i < 512; ++i)
+        handler->broadcast(message, MessageLane::Bulk, CoalescingKey::guiSize());
+
+    if (policy == SlowConsumerPolicy::Cancel) {
+        // The server ends the call, the client never cancelled it.
+        REQUIRE(waitFor([&] { return handler->numStreams() == 0; }));
+        REQUIRE(client.finish().error_code() == grpc::StatusCode::CANCELLED);
+        return;
+    }
+    const auto stats = handler->streamStats();
+    REQUIRE(stats.size() == 1);
+    REQUIRE(stats.front().queueDepth <= Limit);
+    REQUIRE(stats.front().droppedMessages > 0);
+    // All messages share a key, so they take a single queue entry.
+    if (policy == SlowConsumerPolicy::Coalesce)
+        REQUIRE(stats.front().queueDepth <= 1);
+}
+
+TEST_CASE("ProducerWakeups", "[server]")
+{
+    using namespace clap::rpc;
+    // A spinning worker never parks within the test, a parking one parks as
+    // soon as it runs out of work. Push latencies are reported by bench_e2e.
+    const bool isParking = GENERATE(false, true);
+    const WaitStrategy wait = isParking ? WaitStrategy{ .spinCount = 0, .yieldCount = 0 }
+                                        : WaitStrategy{ .spinCount = ~uint32_t(0) };
+    Server::configure({ .addressUri = "localhost:0", .dispatchWorkers = 1, .workerWait = wait });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    constexpr uint64_t NumRounds = 256;
+    api::ServerMessage message;
+    message.mutable_host()->mutable_host()->set_name("wakeup");
+    for (uint64_t round = 1; round <= NumRounds; ++round) {
+        if (isParking && round % 8 == 0) // let the worker park
+            std::this_thread::sleep_for(200us);
+        handler->pushMessage(message);
+        // No wakeup is lost, every round is dispatched.
+        REQUIRE(waitFor([&] { return handler->stats().dispatchedMessages == round; }));
+    }
+
+    // Producers only enter the kernel for a worker that announced it parks,
+    // and at most once per round as the next push waits for the dispatch.
+    const auto worker = server->stats().workers.front();
+    CAPTURE(worker.parks, worker.kernelWakes);
+    if (!isParking) {
+        REQUIRE(worker.parks == 0);
+        REQUIRE(worker.kernelWakes == 0);
+    } else {
+        REQUIRE(worker.kernelWakes <= worker.parks);
+        REQUIRE(worker.kernelWakes <= NumRounds);
+    }
+}
+
+namespace {
+// Reads size bytes, false on EOF or if nothing arrived within the timeout.
+bool readFull(int fd, void *data, size_t size, std::chrono::milliseconds timeout = 5s)
+{
+    auto *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0)
+            return false;
+        const auto n = read(fd, bytes, size);
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Body of the reader process. Echoes every record through the records pipe,
+// so the server never outruns it. Returns the exit code.
+int readRing(clap::rpc::shm::DescriptorReceiver &receiver, int control, int records, int count)
+{
+    using namespace clap::rpc;
+    shm::Descriptors fds = {};
+    if (receiver.receive(&fds, 5s) != 0)
+        return 1;
+    std::array<uint64_t, 2> layout = {}; // size and start
+    if (!readFull(control, layout.data(), sizeof(layout)))
+        return 2;
+    shm::RingReader reader;
+    if (!reader.attach(fds, layout[0], layout[1]))
+        return 3;
+
+    std::string record;
+    for (int i = 0; i < count; ++i) {
+        const auto deadline = std::chrono::steady_clock::now() + 5s;
+        auto result = shm::RingReader::Result::Empty;
+        while ((result = reader.tryRead(&record)) == shm::RingReader::Result::Empty) {
+            if (std::chrono::steady_clock::now() > deadline)
+                return 4;
+            reader.wait(100ms);
+        }
+        if (result == shm::RingReader::Result::Overrun)
+            return 5;
+        const auto size = static_cast<uint32_t>(record.size());
+        if (write(records, &size, sizeof(size)) != sizeof(size)
+            || write(records, record.data(), size) != static_cast<ssize_t>(size))
+            return 6;
+    }
+    // Nothing else may show up in the ring.
+    char done = 0;
+    if (!readFull(control, &done, sizeof(done)))
+        return 7;
+    return reader.tryRead(&record) == shm::RingReader::Result::Empty ? 0 : 8;
+}
+} // namespace
+
+TEST_CASE("SharedMemory", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0", .sharedMemory = { .ringSize = 4096 } });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    // Without a socket there is no way to pass the descriptors.
+    api::ClientMessage request;
+    request.mutable_transport()->set_request(api::transport::Client::SHARED_MEMORY_ENABLE);
+    REQUIRE(client->Write(request));
+    api::ServerMessage message;
+    REQUIRE(client->Read(&message));
+    REQUIRE(message.transport().has_error());
+
+    // The reader is a separate process, it receives the descriptors through
+    // the socket it listens on.
+    constexpr int NumNotes = 200; // wraps the ring several times
+    shm::DescriptorReceiver receiver("clap-rpc-shm-test-" + std::to_string(getpid()));
+    REQUIRE(receiver.isListening());
+    std::array<int, 2> control = {};
+    std::array<int, 2> records = {};
+    REQUIRE(pipe(control.data()) == 0);
+    REQUIRE(pipe(records.data()) == 0);
+    const pid_t reader = fork();
+    REQUIRE(reader >= 0);
+    if (reader == 0) {
+        close(control[1]);
+        close(records[0]);
+        _exit(readRing(receiver, control[0], records[1], NumNotes));
+    }
+    close(control[0]);
+    close(records[1]);
+    const auto finish = [&] {
+        close(control[1]);
+        close(records[0]);
+        int status = 0;
+        waitpid(reader, &status, 0);
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    };
+
+    request.mutable_transport()->set_socket(receiver.name());
+    REQUIRE(client->Write(request));
+    REQUIRE(client->Read(&message));
+    CAPTURE(message.transport().error());
+    REQUIRE(message.transport().has_shared_memory());
+    const auto &info = message.transport().shared_memory();
+    REQUIRE(info.version() == shm::RingVersion);
+    const std::array<uint64_t, 2> layout = { info.size(), info.start() };
+    REQUIRE(write(control[1], layout.data(), sizeof(layout)) == sizeof(layout));
+
+    api::ServerMessage note;
+    note.mutable_event()->mutable_event()->mutable_note()->set_note_id(7);
+    std::string record;
+    for (int i = 0; i < NumNotes; ++i) {
+        note.mutable_event()->mutable_event()->mutable_note()->set_key(i);
+        handler->pushMessage(note);
+        uint32_t size = 0;
+        REQUIRE(readFull(records[0], &size, sizeof(size)));
+        record.resize(size);
+        REQUIRE(readFull(records[0], record.data(), size));
+        api::ServerMessage received;
+        REQUIRE(received.ParseFromString(record));
+        REQUIRE(received.event().event().note().note_id() == 7);
+        REQUIRE(received.event().event().note().key() == i);
+    }
+
+    // Everything else still goes over the stream.
+    api::ServerMessage host;
+    host.mutable_host()->mutable_host()->set_name("bulk");
+    handler->pushMessage(host);
+    REQUIRE(client->Read(&message));
+    REQUIRE(message.host().host().name() == "bulk");
+    const char done = 0;
+    REQUIRE(write(control[1], &done, sizeof(done)) == sizeof(done));
+    REQUIRE(finish() == 0);
+}
+
+TEST_CASE("SharedMemorySubscriptions", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0", .sharedMemory = { .ringSize = 4096 } });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream local(*stub, handler->id());
+    EventStream remote(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 2; }));
+
+    // The local reader doesn't want MIDI.
+    api::ClientMessage request;
+    request.mutable_event()->set_request(api::event::Client::MIDI_DISABLE);
+    REQUIRE(local->Write(request));
+    shm::DescriptorReceiver receiver("clap-rpc-shm-sub-" + std::to_string(getpid()));
+    REQUIRE(receiver.isListening());
+    request.mutable_transport()->set_request(api::transport::Client::SHARED_MEMORY_ENABLE);
+    request.mutable_transport()->set_socket(receiver.name());
+    REQUIRE(local->Write(request));
+    api::ServerMessage message;
+    REQUIRE(local->Read(&message));
+    REQUIRE(message.transport().has_shared_memory());
+    shm::Descriptors fds = {};
+    REQUIRE(receiver.receive(&fds, 5s) == 0);
+    shm::RingReader reader;
+    REQUIRE(reader.attach(fds, message.transport().shared_memory().size(),
+        message.transport().shared_memory().start()));
+
+    api::ServerMessage note;
+    note.mutable_event()->mutable_event()->mutable_note()->set_key(60);
+    api::ServerMessage midi;
+    midi.mutable_event()->mutable_event()->mutable_midi()->set_data("\x90\x40\x7f");
+    api::ServerMessage param;
+    param.mutable_event()->mutable_event()->mutable_param()->set_param_id(3);
+    api::ServerMessage bye;
+    bye.mutable_host()->mutable_host()->set_name("bye");
+    for (const auto *sent : { &note, &midi, &param, &bye })
+        handler->broadcast(*sent);
+
+    // MIDI bypasses the ring, which only the local reader sees.
+    std::string record;
+    for (const auto *expected : { &note, &param }) {
+        REQUIRE(reader.tryRead(&record) == shm::RingReader::Result::Record);
+        REQUIRE(record == expected->SerializeAsString());
+    }
+    REQUIRE(reader.tryRead(&record) == shm::RingReader::Result::Empty);
+    REQUIRE(local->Read(&message));
+    REQUIRE(message.host().host().name() == "bye");
+    for (const auto *expected : { &note, &midi, &param, &bye }) {
+        REQUIRE(remote->Read(&message));
+        REQUIRE(message.SerializeAsString() == expected->SerializeAsString());
+    }
+}
+
+TEST_CASE("LocalSocket", "[server]")
+{
+    using namespace clap::rpc;
+    const std::string uri = "unix-abstract:clap-rpc-test-" + std::to_string(getpid());
+    Server::configure({ .addressUri = uri,
+        .maxReceiveMessageSize = 1024,
+        .keepalive = { .time = std::chrono::seconds(1),
+            .timeout = std::chrono::milliseconds(500),
+            .permitWithoutCalls = true },
+        .resources = { .maxThreads = 8, .maxMemory = size_t(16) << 20 },
+        .http2 = { .streamWindowSize = 1 << 16, .bdpProbe = false } });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    REQUIRE(server->uri() == uri);
+    REQUIRE(server->port() == -1);
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+
+    api::ClientMessage request;
+    request.mutable_host()->set_request(api::host::Client::PROCESS);
+    REQUIRE(client->Write(request));
+    api::ClientMessage received;
+    REQUIRE(handler->popFor(&received, 5s));
+    REQUIRE(received.host().request() == api::host::Client::PROCESS);
+
+    // Messages above the receive limit end the stream.
+    request.mutable_custom()->set_value(std::string(4096, 'x'));
+    client->Write(request);
+    client->WritesDone();
+    REQUIRE(client.finish().error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED);
+}
+
+TEST_CASE("BlockingPop", "[server]")
+{
+    using namespace clap::rpc;
+    using namespace std::chrono_literals;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    api::ClientMessage received;
+    const auto begin = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(handler->popFor(&received, 20ms));
+    REQUIRE(std::chrono::steady_clock::now() - begin >= 20ms);
+
+    const int fd = handler->clientMessageFd();
+    REQUIRE(fd >= 0);
+    REQUIRE(handler->clientMessageFd() == fd);
+    pollfd pfd = { fd, POLLIN, 0 };
+    REQUIRE(poll(&pfd, 1, 0) == 0);
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+
+    api::ClientMessage request;
+    request.mutable_host()->set_request(api::host::Client::CALLBACK);
+    REQUIRE(client->Write(request));
+    received = handler->pop();
+    REQUIRE(received.host().request() == api::host::Client::CALLBACK);
+    REQUIRE(poll(&pfd, 1, 5000) == 1);
+    uint64_t count = 0;
+    REQUIRE(read(fd, &count, sizeof(count)) == sizeof(count));
+    REQUIRE(poll(&pfd, 1, 0) == 0);
+
+    request.mutable_host()->set_request(api::host::Client::RESTART);
+    REQUIRE(client->Write(request));
+    REQUIRE(poll(&pfd, 1, 5000) == 1);
+    REQUIRE(read(fd, &count, sizeof(count)) == sizeof(count));
+    REQUIRE(handler->popFor(&received, 0ms));
+    REQUIRE(received.host().request() == api::host::Client::RESTART);
+}
+
+TEST_CASE("Coroutines", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    // Answers every request on the "main thread" until it is told to stop.
+    QueuedExecutor executor;
+    int handled = 0;
+    bool finished = false;
+    auto responder = [&]() -> FireAndForget {
+        while (true) {
+            const auto request = co_await handler->nextClientMessage(executor);
+            if (request.host().request() == api::host::Client::RESTART)
+                break;
+            api::ServerMessage reply;
+            reply.mutable_host()->mutable_host()->set_name(std::to_string(handled));
+            const size_t written = co_await handler->send(std::move(reply), executor);
+            if (written == 1)
+                ++handled;
+        }
+        finished = true;
+    };
+    responder();
+    REQUIRE(executor.runPending() == 0);
+
+    std::atomic<int> received = 0;
+    std::thread remote([&] {
+        api::ClientMessage request;
+        request.mutable_host()->set_request(api::host::Client::CALLBACK);
+        api::ServerMessage reply;
+        for (int i = 0; i < 3; ++i) {
+            if (!client->Write(request) || !client->Read(&reply))
+                return;
+            if (reply.host().host().name() == std::to_string(i))
+                ++received;
+        }
+        request.mutable_host()->set_request(api::host::Client::RESTART);
+        client->Write(request);
+    });
+    const bool isFinished = waitFor([&] {
+        executor.runPending();
+        return finished;
+    });
+    if (!isFinished)
+        client.tryCancel();
+    remote.join();
+    REQUIRE(isFinished);
+    REQUIRE(received == 3);
+    REQUIRE(handled == 3);
+}
+
+TEST_CASE("SendWithoutStreams", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    // Nothing keeps a send pending, the loop continues without suspending
+    // instead of resuming itself from within every send.
+    constexpr int NumSends = 100'000;
+    size_t written = 0;
+    bool finished = false;
+    auto sender = [&]() -> FireAndForget {
+        api::ServerMessage message;
+        message.mutable_host()->mutable_host()->set_name("nobody");
+        for (int i = 0; i < NumSends; ++i)
+            written += co_await handler->send(message);
+        finished = true;
+    };
+    sender();
+    REQUIRE(finished);
+    REQUIRE(written == 0);
+}
+
+TEST_CASE("Stats", "[server]")
+{
+    using namespace clap::rpc;
+    using namespace std::chrono_literals;
+
+    LatencyHistogram histogram;
+    for (int i = 0; i < 99; ++i)
+        histogram.record(100ns);
+    histogram.record(1ms);
+    const auto latency = histogram.snapshot();
+    REQUIRE(latency.count == 100);
+    REQUIRE(latency.max == 1ms);
+    REQUIRE(latency.percentile(0.5) == 128ns);
+    REQUIRE(latency.percentile(1.0) == 1ms);
+
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+    auto handler = server->createStreamHandler();
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, handler->id());
+    REQUIRE(waitFor([&] { return handler->numStreams() == 1; }));
+
+    constexpr int NumMessages = 16;
+    for (int n = 0; n < NumMessages; ++n) {
+        api::ServerMessage message;
+        message.mutable_host()->mutable_host()->set_name(std::to_string(n));
+        handler->pushMessage(std::move(message));
+    }
+    api::ServerMessage message;
+    for (int n = 0; n < NumMessages; ++n)
+        REQUIRE(client->Read(&message));
+    api::ClientMessage request;
+    request.mutable_host()->set_request(api::host::Client::CALLBACK);
+    REQUIRE(client->Write(request));
+    REQUIRE(handler->popFor(&request, 5s));
+
+    // Write completions may still be on their way.
+    HandlerStats stats;
+    waitFor([&] {
+        stats = handler->stats();
+        return stats.streams.size() != 1 || stats.streams[0].writtenMessages >= NumMessages;
+    });
+    REQUIRE(stats.id == handler->id());
+    REQUIRE(stats.pushedMessages == NumMessages);
+    REQUIRE(stats.dispatchedMessages == NumMessages);
+    REQUIRE(stats.droppedMessages == 0);
+    REQUIRE(stats.clientMessages == 1);
+    REQUIRE(stats.broadcastTime.count == NumMessages);
+    REQUIRE(stats.streams.size() == 1);
+    REQUIRE(stats.streams[0].writtenMessages == NumMessages);
+    REQUIRE(stats.streams[0].writeLatency.count == NumMessages);
+
+    const auto serverStats = server->stats();
+    REQUIRE(serverStats.workers.size() == 1);
+    REQUIRE(serverStats.workers[0].dispatchedMessages >= NumMessages);
+    REQUIRE(std::ranges::any_of(serverStats.handlers,
+        [&](const auto &h) { return h.id == handler->id(); }));
+
+    api::stats::Request statsRequest;
+    statsRequest.set_plugin_id(handler->id());
+    api::stats::Snapshot snapshot;
+    grpc::ClientContext statsContext;
+    REQUIRE(stub->GetStats(&statsContext, statsRequest, &snapshot).ok());
+    REQUIRE(snapshot.workers_size() == 1);
+    REQUIRE(snapshot.handlers_size() == 1);
+    REQUIRE(snapshot.handlers(0).plugin_id() == handler->id());
+    REQUIRE(snapshot.handlers(0).pushed_messages() == NumMessages);
+    REQUIRE(snapshot.handlers(0).broadcast_time().buckets_size()
+        == HistogramSnapshot::BucketCount);
+    REQUIRE(snapshot.handlers(0).streams_size() == 1);
+}
+
+TEST_CASE("HandlerIds", "[server]")
+{
+    using namespace clap::rpc;
+    Server::configure({ .addressUri = "localhost:0" });
+    auto server = Server::uniqueInstance();
+    REQUIRE(server->isRunning());
+
+    std::vector<std::shared_ptr<StreamHandler>> handlers;
+    for (int i = 0; i < 300; ++i)
+        handlers.emplace_back(server->createStreamHandler());
+    std::vector<uint64_t> ids;
+    for (const auto &handler : handlers)
+        ids.push_back(handler->id());
+    std::ranges::sort(ids);
+    REQUIRE(std::ranges::adjacent_find(ids) == ids.end());
+    REQUIRE(server->stats().handlers.size() == handlers.size());
+
+    // A released slot is reused under a new ID, the old one stays unknown.
+    const uint64_t staleId = handlers.front()->id();
+    handlers.front().reset();
+    REQUIRE(server->stats().handlers.size() == handlers.size() - 1);
+    handlers.front() = server->createStreamHandler();
+    const uint64_t reusedId = handlers.front()->id();
+    REQUIRE((reusedId & 0xffffffff) == (staleId & 0xffffffff));
+    REQUIRE((reusedId >> 32) != (staleId >> 32));
+    REQUIRE(server->stats().handlers.size() == handlers.size());
+
+    auto stub = newStub(*server);
+    EventStream client(*stub, staleId);
+    api::ServerMessage message;
+    REQUIRE_FALSE(client->Read(&message));
+    REQUIRE(client.finish().error_code() == grpc::StatusCode::UNAUTHENTICATED);
+
+    handlers.clear();
+    REQUIRE(server->stats().handlers.empty());
+}